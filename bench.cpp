@@ -0,0 +1,101 @@
+#include <iostream>
+#include <fstream>
+
+#define AGGREGATE // Benchmarks run millions of timers, keep one node per name
+#include "timer.hpp"
+
+// Benchmarks of the library itself, written as JSON lines to argv[1] and reported relative
+// to a baseline written the same way on the same machine (argv[2]). Every benchmark is run
+// several times and the run with the lowest median is kept. Timings depend on the machine,
+// so the report does not fail on slower runs
+
+using namespace std::chrono_literals;
+
+constexpr size_t runs = 3;
+std::vector<Timer::Benchmark> results;
+
+template<typename Function>
+void benchmark(std::string name, Function function, size_t per = 1, Timer::clock::duration time = 300ms, size_t batches = 20)
+{
+	Timer::Benchmark best(name);
+	for(size_t run = 0; run < runs; run++)
+	{
+		Timer::Benchmark result(name, time, batches);
+		result.run(function);
+		if(run == 0 || result.median < best.median) best = result;
+	}
+	// Per Start/Stop pair (or rendering)
+	for(double* value: {&best.mean, &best.median, &best.deviation, &best.min, &best.max}) *value /= per;
+	std::cerr << best.json() << std::endl;
+	results.push_back(best);
+}
+
+const char* names[] = {"0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15",
+	"16", "17", "18", "19", "20", "21", "22", "23", "24", "25", "26", "27", "28", "29", "30", "31"};
+
+void nested(size_t depth)
+{
+	if(depth == 0) return;
+	Timer::Scope("Nested");
+	nested(depth - 1);
+}
+
+void tree(size_t depth)
+{
+	if(depth == 0) return;
+	for(size_t i = 0; i < 10; i++) { Timer::Start(std::string_view(names[i])); tree(depth - 1); Timer::Stop(); }
+}
+
+int main(int argc, char** argv)
+{
+	benchmark("Start/Stop", []{ Timer::Start("Flat"); Timer::Stop(); });
+	benchmark("Start/Stop copied name", []{ Timer::Start(std::string_view("Flat")); Timer::Stop(); });
+	benchmark("Scope in loop", []{ for(int i = 0; i < 100; i++) { Timer::Scope("Loop"); Timer::DoNotOptimize(i); } }, 100);
+	benchmark("Nested 32 deep", []{ nested(32); }, 32);
+
+	benchmark("Fan-out 32 children", []{ for(auto name: names) { Timer::Start(std::string_view(name)); Timer::Stop(); } }, 32);
+
+	// Every thread measures its own pairs at the same time, the slowest thread is reported
+	{
+		Timer::Benchmark best("Start/Stop 4 threads");
+		for(size_t run = 0; run < runs; run++)
+		{
+			std::vector<Timer::Benchmark> threads(4, Timer::Benchmark("Start/Stop 4 threads", 300ms));
+			std::vector<std::thread> workers;
+			for(auto& thread: threads) workers.emplace_back([&thread]{ thread.run([]{ Timer::Start("Thread"); Timer::Stop(); }); });
+			for(auto& worker: workers) worker.join();
+			auto slowest = *std::max_element(threads.begin(), threads.end(), [](auto& a, auto& b) { return a.median < b.median; });
+			if(run == 0 || slowest.median < best.median) best = slowest;
+		}
+		std::cerr << best.json() << std::endl;
+		results.push_back(best);
+	}
+
+	// Rendering a tree with 10 * 10 * 10 * 10 timers, in longer batches as one takes milliseconds
+	std::thread([]{ tree(4); }).join();
+	benchmark("string()", []{ Timer::DoNotOptimize(Timer::string()); }, 1, 2s, 10);
+	benchmark("string<Sort, Percentage, Align>()", []{ Timer::DoNotOptimize(Timer::string<Timer::Sort, Timer::Percentage, Timer::Align>()); }, 1, 2s, 10);
+
+	if(argc > 1)
+	{
+		std::ofstream file(argv[1]);
+		for(auto& result: results) file << result.json() << "\n";
+	}
+
+	// Comparison with the baseline
+	if(argc > 2)
+	{
+		std::ifstream baseline(argv[2]);
+		for(std::string line; std::getline(baseline, line);)
+		{
+			auto field = [&](const std::string& key) { size_t at = line.find("\"" + key + "\":"); return at == std::string::npos ? std::string() : line.substr(at + key.size() + 3); };
+			std::string name = field("name");
+			name = name.substr(1, name.find('"', 1) - 1);
+			auto found = std::find_if(results.begin(), results.end(), [&](auto& result) { return result.name == name; });
+			if(found == results.end() || field("median_ns").empty()) continue;
+
+			double ratio = found->median / std::stod(field("median_ns"));
+			std::cout << (ratio > 1.25 ? Timer::RED : ratio < 0.8 ? Timer::GREEN : Timer::RESET) << name << ": " << ratio << "x baseline" << Timer::RESET << std::endl;
+		}
+	}
+}
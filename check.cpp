@@ -0,0 +1,566 @@
+#include <iostream>
+#include <cassert>
+
+#define AGGREGATE
+#define ALLOCATIONS
+#define USAGE
+#define COUNTERS
+#include "timer.hpp"
+
+// Checks of the features and of cases that broke before, run by make check
+
+using namespace std::chrono_literals;
+
+// Appends a timer with exact measurements to a flat tree
+uint32_t timed(Timer::Flat& flat, uint32_t parent, std::string_view name, Timer::clock::duration time, uint64_t count = 1)
+{
+	uint32_t i = flat.node(parent, flat.id(name));
+	Timer::Sample sample;
+	sample.time = time;
+	sample.min = sample.max = time / count;
+	sample.count = count;
+	sample.mean = double((time / count).count());
+	flat.add(i, sample);
+	return i;
+}
+
+// A timer with a histogram gets one call between two snapshots with reset
+void snapshotOneCall()
+{
+	for(int i = 0; i < 3; i++) { Timer::Scope("Tick"); }
+	Timer::snapshot(true);
+	{ Timer::Scope("Tick"); }
+	std::string out = Timer::string<Timer::Calls, Timer::Percentiles>(Timer::snapshot(true));
+	assert(out.find("x1 ") != std::string::npos);
+	Timer::reset();
+}
+
+// Names in char arrays are copied, the array may be overwritten after Stop
+void arrayNames()
+{
+	char name[16];
+	for(int i = 0; i < 3; i++)
+	{
+		std::snprintf(name, sizeof(name), "job%d", i);
+		Timer::Start(name);
+		Timer::Stop();
+		std::snprintf(name, sizeof(name), "XXXXX");
+	}
+	std::string out = Timer::string<Timer::Calls>();
+	assert(out.find("job0") != std::string::npos && out.find("job2") != std::string::npos && out.find("XXXXX") == std::string::npos);
+	Timer::reset();
+}
+
+// Scope with a char array name has no call site cache
+void arrayScopes()
+{
+	char name[16];
+	for(int i = 0; i < 3; i++)
+	{
+		std::snprintf(name, sizeof(name), "job%d", i);
+		Timer::Scope(name);
+	}
+	std::string out = Timer::string<Timer::Calls>();
+	assert(out.find("job0") != std::string::npos && out.find("job1") != std::string::npos && out.find("x3") == std::string::npos);
+	Timer::reset();
+}
+
+// A snapshot keeps its names after reset() reuses the thread arena
+void snapshotNames()
+{
+	char name[16] = "Before";
+	Timer::Start(name); Timer::Stop();
+	Timer::Flat flat = Timer::snapshot();
+	Timer::reset();
+	std::snprintf(name, sizeof(name), "Later!");
+	Timer::Start(name); Timer::Stop();
+	assert(flat.names[flat.name[1]] == "Before");
+	Timer::reset();
+}
+
+// Timers, histograms and stacks of the library are not counted as allocations of the timers
+void libraryAllocations()
+{
+	std::thread([]{
+		for(int i = 0; i < 3; i++) { Timer::Scope("Outer"); for(int j = 0; j < 40; j++) { Timer::Start(std::to_string(j).c_str()); Timer::Stop(); } }
+		Timer::Flat flat = Timer::snapshot();
+		for(uint32_t i = 1; i < flat.size(); i++) assert(flat.usage[i][Timer::resources + Timer::counters + Timer::heapBytes] == 0);
+		Timer::reset();
+	}).join();
+	Timer::reset();
+}
+
+// Loaded snapshots are printed without moving them, the options that change timers work on a copy
+void printLoaded()
+{
+	for(int i = 0; i < 3; i++) { Timer::Scope("Saved"); { Timer::Scope("Inner"); } }
+	assert(Timer::save(Timer::snapshot(), "check.bin"));
+	Timer::reset();
+	Timer::Flat flat;
+	assert(Timer::load("check.bin", flat));
+	std::remove("check.bin");
+	std::string out = Timer::string<Timer::Calls, Timer::Sort, Timer::Percentage, Timer::Percentiles>(flat);
+	assert(out.find("Inner") != std::string::npos && Timer::string<Timer::Calls>(flat) == Timer::string<Timer::Calls>(Timer::Flat(flat)));
+	assert(Timer::openMetrics(flat).find("path=\"Saved/Inner\"") != std::string::npos && flat.time[0] == Timer::clock::duration::zero());
+}
+
+// Histogram buckets count past 32 bits, also through save() and load()
+void heavyBuckets()
+{
+	uint64_t calls = (uint64_t(1) << 32) + 5;
+	Timer::__record(Timer::__child(Timer::timer, Timer::Name("Hot"), true), Timer::clock::now(), std::chrono::milliseconds(10), 1);
+	Timer::__record(Timer::__child(Timer::timer, Timer::Name("Hot"), true), Timer::clock::now(), std::chrono::milliseconds(1), calls - 1);
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.count[1] == calls && flat.percentile(1, 50) < std::chrono::milliseconds(2));
+	assert(Timer::save(flat, "check.bin"));
+	Timer::Flat loaded;
+	assert(Timer::load("check.bin", loaded));
+	std::remove("check.bin");
+	assert(loaded.count[1] == calls && loaded.percentile(1, 50) < std::chrono::milliseconds(2));
+	Timer::reset();
+}
+
+// Corrupt files are rejected without allocating the sizes they claim
+void corruptFiles()
+{
+	{ Timer::Scope("Saved"); }
+	assert(Timer::save(Timer::snapshot(), "check.bin"));
+	Timer::reset();
+	std::FILE* file = std::fopen("check.bin", "r+b");
+	uint32_t length = 0xFFFFFFF0;
+	std::fseek(file, 8 + 8 + 8 + 4 + 4, SEEK_SET); // Length of the first name
+	std::fwrite(&length, sizeof(length), 1, file);
+	std::fclose(file);
+	Timer::Flat flat;
+	assert(not Timer::load("check.bin", flat));
+
+	file = std::fopen("check.bin", "wb");
+	uint32_t header[3] = {'E', 0, 0xFFFFFFF0};
+	std::fwrite("TIMERTRC", 1, 8, file);
+	std::fwrite(header, sizeof(header), 1, file);
+	std::fclose(file);
+	assert(not Timer::load("check.bin"));
+	std::remove("check.bin");
+}
+
+// Timers run in a task are nested in its (active) time, the rest of the task is suspended time
+void taskTimes()
+{
+	{
+		Timer::Task task("Request");
+		{ Timer::Task::Running running(task); Timer::Scope("Parse"); std::this_thread::sleep_for(std::chrono::milliseconds(5)); }
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		{ Timer::Task::Running running(task); Timer::Scope("Reply"); std::vector<char> reply(1000); Timer::DoNotOptimize(reply); }
+	}
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.names[flat.name[1]] == "Request" && flat.names[flat.name[2]] == "(active)" && flat.parent[3] == 2 && flat.parent[4] == 2);
+	assert(flat.time[2] >= flat.total(2) && flat.self(1) >= std::chrono::milliseconds(20) && flat.time[3] >= std::chrono::milliseconds(5));
+	assert(flat.usage[2][Timer::resources + Timer::counters + Timer::heapBytes] >= 1000);
+	Timer::reset();
+}
+
+// Calibration measures into a scratch tree and runs once for Overhead
+void calibration()
+{
+	uint32_t timers = Timer::snapshot().size();
+	Timer::calibrate(1000);
+	assert(Timer::calibrated && Timer::overhead > Timer::clock::duration::zero() && Timer::selfOverhead <= Timer::overhead);
+	assert(Timer::snapshot().size() == timers);
+}
+
+// A benchmark that throws leaves the current timer as it was
+void throwingBenchmark()
+{
+	try { Timer::Benchmark("Throws").run([]{ throw std::runtime_error("failed"); }); assert(false); }
+	catch(const std::runtime_error&) {}
+	assert(Timer::timer == Timer::tree);
+	Timer::reset();
+}
+
+// Printing with Sort keeps later printing sorted (last, it stays for the process)
+void staysSorted()
+{
+	{ Timer::Scope("Short"); }
+	{ Timer::Scope("Long"); std::this_thread::sleep_for(std::chrono::milliseconds(2)); }
+	assert(Timer::string().find("Short") < Timer::string().find("Long"));
+	Timer::string<Timer::Sort>();
+	assert(Timer::string().find("Long") < Timer::string().find("Short"));
+	Timer::reset();
+}
+
+// Repeated timers with the same name and parent share one node (AGGREGATE)
+void aggregated()
+{
+	for(int i = 0; i < 5; i++) { Timer::Scope("Repeated"); { Timer::Scope("Nested"); } }
+	for(int i = 0; i < 2; i++) { Timer::Start("Repeated"); Timer::Stop(); }
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.size() == 3 && flat.count[1] == 7 && flat.count[2] == 5 && flat.parent[2] == 1);
+	Timer::reset();
+}
+
+// Timers of threads are measured into their own trees and merged by call path
+void threadTrees()
+{
+	std::atomic<int> measured = 0;
+	std::atomic<bool> printed = false;
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 3; t++) threads.emplace_back([&]{
+		{ Timer::Scope("Worker"); { Timer::Scope("Step"); } }
+		measured++;
+		while(not printed) std::this_thread::yield();
+		Timer::reset();
+	});
+	while(measured < 3) std::this_thread::yield();
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.size() == 3 && flat.names[flat.name[1]] == "Worker" && flat.count[1] == 3 && flat.count[2] == 3);
+	Timer::Flat perThread = Timer::snapshot<Timer::Threads>();
+	assert(perThread.size() == 10 && perThread.names[perThread.name[1]].substr(0, 7) == "Thread " && perThread.count[2] == 1);
+	printed = true;
+	for(auto& thread: threads) thread.join();
+}
+
+// Names of timers are copied into the arena of the thread, also after reset() reuses it
+void arenaNames()
+{
+	for(int round = 0; round < 2; round++)
+	{
+		for(int i = 0; i < 1000; i++) { Timer::Start(std::string("Timer ") + std::to_string(i)); Timer::Stop(); }
+		Timer::Flat flat = Timer::snapshot();
+		assert(flat.size() == 1001 && flat.names[flat.name[1]] == "Timer 0" && flat.names[flat.name[1000]] == "Timer 999");
+		Timer::reset();
+	}
+}
+
+// Clocks selectable with CLOCK measure the same durations as steady_clock
+template<typename Clock>
+void clockMeasures(std::chrono::milliseconds tolerance)
+{
+	auto start = Clock::now();
+	auto steady = std::chrono::steady_clock::now();
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start);
+	auto expected = std::chrono::steady_clock::now() - steady;
+	assert(elapsed > expected - tolerance && elapsed < expected + tolerance);
+}
+
+void clocks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	clockMeasures<Timer::tsc_clock>(std::chrono::milliseconds(2));
+	clockMeasures<Timer::fenced_tsc_clock>(std::chrono::milliseconds(2));
+#endif
+#ifdef CLOCK_MONOTONIC_COARSE
+	clockMeasures<Timer::coarse_clock>(std::chrono::milliseconds(10));
+#endif
+}
+
+// Overhead of nested pairs is subtracted from the parents, a timer's own part from the timer
+void overheadSubtracted()
+{
+	Timer::Flat flat;
+	uint32_t outer = timed(flat, 0, "Outer", 10ms), inner = timed(flat, outer, "Inner", 5ms, 1000);
+	auto overhead = std::exchange(Timer::overhead, 1us), selfOverhead = std::exchange(Timer::selfOverhead, 500ns);
+	Timer::subtract(flat);
+	Timer::overhead = overhead; Timer::selfOverhead = selfOverhead;
+	assert(flat.time[inner] == 5ms - 1000 * 500ns && flat.time[outer] == 10ms - 1000 * 1us - 500ns);
+}
+
+// Calls of 1 to 100 ms give exact mean and deviation, percentiles within the bucket error (~6%)
+void statistics()
+{
+	Timer::Timer* node = Timer::__child(Timer::timer, Timer::Name("Stats"), true);
+	for(int ms = 1; ms <= 100; ms++) Timer::__record(node, Timer::clock::now(), std::chrono::milliseconds(ms));
+	Timer::Flat flat = Timer::snapshot();
+	auto near = [](double value, double expected, double tolerance) { return std::abs(value - expected) <= tolerance * expected; };
+	auto ms = [](Timer::clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+	assert(flat.count[1] == 100 && flat.min[1] == 1ms && flat.max[1] == 100ms);
+	assert(near(flat.mean[1], std::chrono::duration_cast<Timer::clock::duration>(50.5ms).count(), 1e-9));
+	assert(near(ms(Timer::clock::duration(Timer::clock::rep(flat.deviation(1)))), 29.0115, 1e-3));
+	assert(near(ms(flat.percentile(1, 50)), 50, 0.07) && near(ms(flat.percentile(1, 99)), 99, 0.07) && near(ms(flat.percentile(1, 100)), 100, 0.07));
+	Timer::reset();
+}
+
+// Sampled scopes measure one in N entries, each counting N times
+void sampledScopes()
+{
+	for(int i = 0; i < 100; i++) { Timer::SampledScope(4)("Sampled"); }
+	for(int i = 0; i < 10000; i++) { Timer::RandomScope(4)("Random"); }
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.names[flat.name[1]] == "Sampled" && flat.count[1] == 100);
+	assert(flat.names[flat.name[2]] == "Random" && flat.count[2] > 8000 && flat.count[2] < 12000 && flat.count[2] % 4 == 0);
+	Timer::reset();
+}
+
+// Deep trees are merged, sorted and printed without recursion (printing is quadratic in the depth)
+void deepTree()
+{
+	constexpr int depth = 100000;
+	for(int i = 0; i < depth; i++) Timer::Start("Level");
+	for(int i = 0; i < depth; i++) Timer::Stop();
+	Timer::Flat flat = Timer::snapshot();
+	Timer::sort(flat);
+	assert(flat.size() == depth + 1 && flat.maxDepth == depth && flat.child[depth - 1] == depth);
+	Timer::reset();
+
+	for(int i = 0; i < 2000; i++) Timer::Start("Level");
+	for(int i = 0; i < 2000; i++) Timer::Stop();
+	std::string out = Timer::string();
+	assert(std::count(out.begin(), out.end(), '\n') == 2000);
+	Timer::reset();
+}
+
+// Merging matches children by name, the k-th child with a name to the k-th one, and appends the others
+void mergedByName()
+{
+	{ Timer::Scope("Job"); { Timer::Scope("Parse"); } }
+	{ Timer::Scope("Other"); }
+	Timer::Flat flat;
+	uint32_t first = timed(flat, 0, "Job", 1ms), second = timed(flat, 0, "Job", 2ms);
+	Timer::merge(flat, 0, Timer::tree);
+	assert(flat.size() == 5 && flat.count[first] == 2 && flat.count[second] == 1);
+	assert(flat.names[flat.name[flat.child[first]]] == "Parse" && flat.parent[3] == 0 && flat.names[flat.name[3]] == "Other");
+	Timer::reset();
+}
+
+// snapshot(true) returns the calls since the previous snapshot(true), snapshot() all of them
+void snapshotDeltas()
+{
+	Timer::Timer* node = Timer::__child(Timer::timer, Timer::Name("Delta"), true);
+	for(int i = 0; i < 3; i++) Timer::__record(node, Timer::clock::now(), 1ms);
+	Timer::Flat first = Timer::snapshot(true);
+	assert(first.count[1] == 3 && first.time[1] == 3ms);
+	for(int i = 0; i < 2; i++) Timer::__record(node, Timer::clock::now(), 5ms);
+	Timer::Flat second = Timer::snapshot(true), all = Timer::snapshot();
+	assert(second.count[1] == 2 && second.time[1] == 10ms && second.percentile(1, 50) == 5ms && std::abs(second.mean[1] - Timer::clock::duration(5ms).count()) < 1e-6);
+	assert(all.count[1] == 5 && all.time[1] == 13ms);
+	assert(Timer::snapshot(true).count[1] == 0);
+	Timer::reset();
+}
+
+// Timers are exported as OpenMetrics summaries labelled by call path, also periodically to a file
+void metricsExport()
+{
+	Timer::Flat flat;
+	uint32_t outer = timed(flat, 0, "Outer", 3ms, 2);
+	timed(flat, outer, "Say \"hi\"", 1ms);
+	std::string metrics = Timer::openMetrics(flat);
+	assert(metrics.rfind("# TYPE timer_seconds summary\n", 0) == 0 && metrics.size() > 6 && metrics.substr(metrics.size() - 6) == "# EOF\n");
+	assert(metrics.find("timer_seconds_sum{path=\"Outer\"} 0.003\n") != std::string::npos);
+	assert(metrics.find("timer_seconds_count{path=\"Outer\"} 2\n") != std::string::npos);
+	assert(metrics.find("timer_seconds_count{path=\"Outer/Say \\\"hi\\\"\"} 1\n") != std::string::npos);
+	assert(metrics.find("timer_seconds{path=\"Outer\",quantile=\"0.5\"} 0.0015\n") != std::string::npos);
+
+	{ Timer::Scope("Reported"); }
+	std::remove("check.prom");
+	assert(Timer::report("check.prom", 10ms));
+	std::string written;
+	for(int i = 0; i < 500 && written.find("# EOF") == std::string::npos; i++)
+	{
+		std::this_thread::sleep_for(10ms);
+		if(std::FILE* file = std::fopen("check.prom", "r")) { char text[4096]; written.assign(text, std::fread(text, 1, sizeof(text), file)); std::fclose(file); }
+	}
+	Timer::reporter.stop();
+	std::remove("check.prom");
+	assert(written.find("timer_seconds_count{path=\"Reported\"} 1\n") != std::string::npos);
+	Timer::reset();
+}
+
+// A task resumed on other threads nests their timers in its (active) time, merged by call path
+void taskAcrossThreads()
+{
+	std::atomic<bool> parsed = false, printed = false;
+	std::thread worker;
+	{
+		Timer::Scope("Server");
+		Timer::Task task("Request");
+		worker = std::thread([&]{
+			{ Timer::Task::Running running(task); Timer::Scope("Parse"); std::this_thread::sleep_for(2ms); }
+			parsed = true;
+			while(not printed) std::this_thread::yield();
+			Timer::reset();
+		});
+		while(not parsed) std::this_thread::yield();
+		{ Timer::Task::Running running(task); Timer::Scope("Reply"); }
+	}
+	Timer::Flat flat = Timer::snapshot();
+	printed = true;
+	worker.join();
+	assert(flat.size() == 6 && flat.names[flat.name[1]] == "Server" && flat.names[flat.name[2]] == "Request" && flat.names[flat.name[3]] == "(active)");
+	assert(flat.count[2] == 1 && flat.count[3] == 1 && flat.time[3] >= 2ms && flat.parent[4] == 3 && flat.parent[5] == 3);
+	std::string out = Timer::string<Timer::Calls>(flat);
+	assert(out.find("Parse") != std::string::npos && out.find("Reply") != std::string::npos);
+	Timer::reset();
+}
+
+// Timers measure the CPU time and context switches of their thread (USAGE)
+void resourceUsage()
+{
+	{
+		Timer::Scope("Busy");
+		auto until = std::chrono::steady_clock::now() + 20ms;
+		while(std::chrono::steady_clock::now() < until) {}
+	}
+	{ Timer::Scope("Sleeping"); std::this_thread::sleep_for(20ms); }
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.usage[1][Timer::cpuTime] >= 10000000 && flat.usage[1][Timer::cpuTime] <= uint64_t(flat.time[1].count()) * 2);
+	assert(flat.usage[2][Timer::cpuTime] < 10000000 && flat.usage[2][Timer::voluntarySwitches] >= 1);
+	assert(Timer::string<Timer::Usage>(flat).find("cpu") != std::string::npos);
+	Timer::reset();
+}
+
+// Timers count hardware events with COUNTERS, events that can not be opened stay zero
+void hardwareCounters()
+{
+	{ Timer::Scope("Loop"); for(volatile int i = 0; i < 1000000; i = i + 1) {} }
+	Timer::Flat flat = Timer::snapshot();
+	uint64_t instructions = flat.usage[1][Timer::resources + Timer::instructions];
+	assert(Timer::perfCounters.available() ? instructions >= 1000000 : instructions == 0);
+	Timer::reset();
+}
+
+// Heap allocations of the user count in the timer and its parents, the peak of live bytes as maximum
+void userAllocations()
+{
+	{
+		Timer::Scope("Outer");
+		{ Timer::Scope("Allocating"); std::vector<char> block(100000); Timer::DoNotOptimize(block); }
+		std::vector<char> small(1000);
+		Timer::DoNotOptimize(small);
+	}
+	Timer::Flat flat = Timer::snapshot();
+	auto heap = [&](uint32_t i, size_t u) { return flat.usage[i][Timer::resources + Timer::counters + u]; };
+	assert(heap(2, Timer::heapBytes) >= 100000 && heap(2, Timer::heapAllocations) == 1 && heap(2, Timer::heapPeak) >= 100000);
+	assert(heap(1, Timer::heapBytes) >= 101000 && heap(1, Timer::heapAllocations) == 2 && heap(1, Timer::heapPeak) < 101000 + 1000);
+	Timer::reset();
+}
+
+// A benchmark records its batches as weighted calls of its timer, with timers of the function nested
+void benchmarkBatches()
+{
+	Timer::Benchmark benchmark("Sleep", 50ms, 5, 5ms);
+	benchmark.run([]{ Timer::Scope("Inner"); std::this_thread::sleep_for(1ms); });
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.names[flat.name[1]] == "Sleep" && flat.count[1] == benchmark.iterations * (benchmark.batches - benchmark.rejected));
+	assert(flat.names[flat.name[2]] == "Inner" && flat.parent[2] == 1 && flat.count[2] >= flat.count[1]);
+	assert(benchmark.median >= 1e6 && benchmark.min <= benchmark.median && benchmark.median <= benchmark.max);
+	assert(benchmark.json().rfind("{\"name\":\"Sleep\",\"iterations\":", 0) == 0);
+	Timer::reset();
+}
+
+// Names are identified by their hash, computed at compile time for constexpr names
+void nameHashes()
+{
+	static constexpr Timer::Name Parse = "Parse";
+	static_assert(Parse.hash == Timer::__hash("Parse") && Parse.hash != Timer::Name("Parsed").hash);
+	Timer::Start(Parse); Timer::Stop();
+	Timer::Start("Parse"); Timer::Stop();
+	Timer::Start(std::string("Parse")); Timer::Stop();
+	{ Timer::Scope("Parse"); }
+	{ Timer::Scope(Parse); }
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.size() == 2 && flat.count[1] == 5);
+	Timer::reset();
+}
+
+// The timer cached per Scope call site follows the parent and is dropped by reset()
+void step() { Timer::Scope("Step"); }
+
+void siteCache()
+{
+	for(int i = 0; i < 2; i++) { { Timer::Scope("First"); step(); } { Timer::Scope("Second"); step(); step(); } }
+	Timer::Flat flat = Timer::snapshot();
+	assert(flat.size() == 5 && flat.names[flat.name[1]] == "First" && flat.names[flat.name[2]] == "Second");
+	assert(flat.names[flat.name[flat.child[1]]] == "Step" && flat.count[flat.child[1]] == 2);
+	assert(flat.names[flat.name[flat.child[2]]] == "Step" && flat.count[flat.child[2]] == 4);
+	Timer::reset();
+	{ Timer::Scope("First"); step(); }
+	flat = Timer::snapshot();
+	assert(flat.size() == 3 && flat.count[2] == 1);
+	Timer::reset();
+}
+
+// Snapshots saved and loaded again are equal, diff() matches timers by call path
+void savedDiff()
+{
+	Timer::Flat baseline;
+	uint32_t outer = timed(baseline, 0, "Outer", 10ms, 5);
+	timed(baseline, outer, "Inner", 4ms, 2);
+	timed(baseline, 0, "Gone", 1ms);
+	assert(Timer::save(baseline, "check.bin"));
+	Timer::Flat loaded;
+	assert(Timer::load("check.bin", loaded));
+	std::remove("check.bin");
+	assert(Timer::string<Timer::Calls>(loaded) == Timer::string<Timer::Calls>(baseline) && loaded.mean[1] == baseline.mean[1]);
+
+	Timer::Flat candidate;
+	outer = timed(candidate, 0, "Outer", 15ms, 5);
+	timed(candidate, outer, "Inner", 4ms, 2);
+	timed(candidate, outer, "Added", 2ms);
+	std::string out = Timer::diff(loaded, candidate);
+	assert(out.find("Outer: 10ms -> 15") != std::string::npos && out.find("+5ms (+50%)") != std::string::npos);
+	assert(out.find("Inner: 4ms -> 4") != std::string::npos && out.find("+0ms (+0%)") != std::string::npos);
+	assert(out.find("(new)") != std::string::npos && out.find("(removed)") != std::string::npos);
+}
+
+// Folded stacks have one line per call path with its self time, names cannot break the format
+void foldedStacks()
+{
+	Timer::Flat flat;
+	uint32_t outer = timed(flat, 0, "Outer", 10ms);
+	timed(flat, outer, "Inner", 4ms, 2);
+	timed(flat, outer, "A;B", 1ms);
+	assert(Timer::folded(flat) == "Outer 5000\nOuter;Inner 4000\nOuter;A:B 1000\n");
+	assert(Timer::folded<std::chrono::milliseconds>(flat) == "Outer 5\nOuter;Inner 4\nOuter;A:B 1\n");
+}
+
+// Hotspots sum the self time of a name over all call paths, Self shows it per timer
+void hotspotsSelf()
+{
+	Timer::Flat flat;
+	uint32_t first = timed(flat, 0, "First", 10ms), second = timed(flat, 0, "Second", 8ms);
+	timed(flat, first, "Parse", 6ms, 3);
+	timed(flat, second, "Parse", 2ms, 1);
+	std::string out = Timer::hotspots(flat, 2);
+	assert(out.find("1. Parse: 8") < out.find("2. Second: 6") && out.find("2. Second: 6") != std::string::npos && out.find("First") == std::string::npos);
+	assert(out.find("44.4") != std::string::npos && out.find("x4") != std::string::npos);
+	out = Timer::string<Timer::Self>(flat);
+	assert(out.find("self 4ms") != std::string::npos && out.find("self 6ms") != std::string::npos && out.find("self 2ms") != std::string::npos);
+}
+
+int main()
+{
+	snapshotOneCall();
+	arrayNames();
+	arrayScopes();
+	snapshotNames();
+	libraryAllocations();
+	printLoaded();
+	heavyBuckets();
+	corruptFiles();
+	taskTimes();
+	calibration();
+	throwingBenchmark();
+	aggregated();
+	threadTrees();
+	arenaNames();
+	clocks();
+	overheadSubtracted();
+	statistics();
+	sampledScopes();
+	deepTree();
+	mergedByName();
+	snapshotDeltas();
+	metricsExport();
+	taskAcrossThreads();
+	resourceUsage();
+	hardwareCounters();
+	userAllocations();
+	benchmarkBatches();
+	nameHashes();
+	siteCache();
+	savedDiff();
+	foldedStacks();
+	hotspotsSelf();
+	staysSorted();
+	std::cout << "All checks passed" << std::endl;
+}
@@ -0,0 +1,59 @@
+#include <iostream>
+#include <cassert>
+
+#define TRACE
+#define CATEGORIES (1 << 0)
+#include "timer.hpp"
+
+// Checks of the TRACE mode (with CATEGORIES), a separate program as modes are compile time, run by make check
+
+// Events of all threads are written to the trace file and load() rebuilds their trees
+void replay()
+{
+	assert(Timer::trace("check.trace"));
+	for(int i = 0; i < 3; i++) { Timer::Scope("Frame"); { Timer::Scope("Draw"); } }
+	std::thread([]{ Timer::Start(std::string("Worker")); Timer::Stop(); }).join();
+	Timer::flush();
+
+	assert(Timer::load("check.trace"));
+	std::remove("check.trace");
+	Timer::Flat flat = Timer::snapshot<Timer::Threads>();
+	std::string out = Timer::string<Timer::Calls>();
+	assert(out.find("Frame") != std::string::npos && out.find("Draw") != std::string::npos && out.find("Worker") != std::string::npos);
+	uint64_t frames = 0;
+	for(uint32_t i = 1; i < flat.size(); i++) if(flat.names[flat.name[i]] == "Frame") { frames += flat.count[i]; assert(flat.names[flat.name[flat.child[i]]] == "Draw"); }
+	assert(frames == 3);
+}
+
+// Replayed timers are intervals of the Chrome trace, after replay()
+void chromeTrace()
+{
+	std::string trace = Timer::chromeTrace();
+	size_t frames = 0;
+	for(size_t at = trace.find("\"name\":\"Frame\""); at != std::string::npos; at = trace.find("\"name\":\"Frame\"", at + 1)) frames++;
+	assert(frames == 3 && trace.find("\"name\":\"Worker\"") != std::string::npos);
+	assert(trace.rfind("{\"traceEvents\":[", 0) == 0 && trace.find("\"ph\":\"X\",\"ts\":") != std::string::npos);
+}
+
+// Timers of categories out of CATEGORIES compile to nothing, also in the trace
+void categories()
+{
+	constexpr Timer::Category Shown = 1 << 0, Hidden = 1 << 1;
+	static_assert(Timer::enabled(Shown) && not Timer::enabled(Hidden));
+	assert(Timer::trace("check.trace"));
+	{ Timer::ScopeIn(Shown)("Shown"); { Timer::ScopeIn(Hidden)("Hidden"); } }
+	Timer::Start<Hidden>("Hidden"); Timer::Stop<Hidden>();
+	Timer::flush();
+	assert(Timer::load("check.trace"));
+	std::remove("check.trace");
+	std::string out = Timer::string();
+	assert(out.find("Shown") != std::string::npos && out.find("Hidden") == std::string::npos);
+}
+
+int main()
+{
+	replay();
+	chromeTrace();
+	categories();
+	std::cout << "All trace checks passed" << std::endl;
+}
@@ -50,4 +50,8 @@ int main()
 	std::cout << Timer::string<Timer::Align>() << std::endl; // Aligns columns
 	std::cout << Timer::string<Timer::Sort, Timer::Align>() << std::endl; // Sorts by time
 	std::cout << Timer::string<std::chrono::microseconds, Timer::Percentage, Timer::Align>() << std::endl; // Will still be sorted
+
+	// Runs loop() in auto-scaled batches, recorded as the timer "loop(1000)"
+	std::cout << Timer::Benchmark("loop(1000)", std::chrono::milliseconds(200)).run([]{ loop(1000); }).json() << std::endl;
+	std::cout << Timer::string<std::chrono::nanoseconds, Timer::Calls, Timer::Mean>() << std::endl;
 }
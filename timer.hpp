@@ -1,18 +1,80 @@
 #include <chrono>
 #include <string>
+#include <string_view>
+#include <memory>
+#include <cstring>
+#include <cstdint>
 #include <vector>
 #include <stack>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <unordered_map>
+#include <cstdio>
+#include <cmath>
+#include <utility>   // std::exchange
 #include <sstream>
 #include <algorithm> // std::sort
 #include <numeric>   // std::accumulate
-#include <iomanip>   // std::setw
+#include <iterator>  // std::distance
+#include <functional>
+#include <array>
+#include <limits>
+#include <time.h>    // clock_gettime
+#include <new>
+#ifdef USAGE
+#include <sys/resource.h> // getrusage
+#endif
+#ifdef ALLOCATIONS
+#include <malloc.h> // malloc_usable_size
+#include <cstdlib>
+#endif
+#ifdef COUNTERS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#ifdef SERVER
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#endif
 
 namespace Timer
 {
 	// Compile time code 
 	
 	// #define SAFE // Introduces small overhead -- use when nanoseconds are not important
+	// #define AGGREGATE // Timers with the same name and parent share one node -- use for timers in loops
+	// #define TRACE // Record Start/Stop events to a ring buffer and file instead of building the tree
+	// #define DISABLE // Start, Stop and Scope compile to nothing
+	// #define CATEGORIES (1 << 0 | 1 << 2) // Only timers of these categories are measured
+	// #define CLOCK Timer::tsc_clock // Clock used for measurements, see clocks below
+	// #define USAGE // Also measure thread CPU time, context switches and page faults (two syscalls per Start/Stop)
+	// #define COUNTERS // Also measure hardware counters with perf_event_open (Linux, one syscall per Start/Stop)
+	// #define ALLOCATIONS // Also count heap allocations, replaces the global operator new and delete (glibc)
+	// #define SERVER // Enables Timer::serve(port), an OpenMetrics endpoint (POSIX sockets)
 	
+	// Bit mask of measured categories, e.g. Timer::Start<Physics>("Step") with constexpr Timer::Category Physics = 1 << 0
+	using Category = uint64_t;
+	constexpr Category all = ~Category(0);
+	constexpr bool enabled([[maybe_unused]] Category category)
+	{
+#if defined(DISABLE)
+		return false;
+#elif defined(CATEGORIES)
+		return (category & Category(CATEGORIES)) != 0;
+#else
+		return category != 0;
+#endif
+	}
+
 	#define isOption(Option, ...) constexpr ((std::is_same_v<Option, __VA_ARGS__> || ...))	
 	
 	template<typename Period> struct __units    { static constexpr const char* value = "?";  };
@@ -46,135 +108,2049 @@ namespace Timer
 		return RED;
 	}
 
+	// Color of a relative change of time in percent, see diff()
+	const std::string& deltaColor(double percentage)
+	{
+		if(percentage < -5.0) return GREEN;
+		if(percentage <= 5.0) return YELLOW;
+		return RED;
+	}
+
 	// Print options
 	struct Sort 	  {}; // Sort by time
 	struct Percentage {}; // Display percentage of outer timer
+	struct Self       {}; // Display self time, i.e. without nested timers
+	struct Hotspots   {}; // Append the 10 names with the most self time over all call paths (see hotspots())
 	struct Align 	  {}; // Align as columns
 	struct Color      {}; // Color the output
+	struct Calls      {}; // Display call count, min and max time (see AGGREGATE)
+	struct Mean       {}; // Display mean time of a call and its standard deviation
+	struct Percentiles{}; // Display p50, p90, p99 and p99.9 of call times
+	struct Threads    {}; // Display a subtree per thread instead of merging threads by call path
+	struct Overhead   {}; // Subtract the Start/Stop overhead of nested timers (see calibrate())
+	struct Usage      {}; // Display CPU time, voluntary/involuntary context switches and minor/major page faults (see USAGE)
+	struct Counters   {}; // Display cycles, instructions per cycle and cache/branch/LLC misses per 1000 instructions (see COUNTERS)
+	struct Allocations{}; // Display allocated bytes, allocation count and peak of live bytes (see ALLOCATIONS)
 	
 	// TODO:
 	// struct Units      {}; // Automatic units
 
-	size_t maxNameLength = 0;
-	size_t maxDepth = 0;
 	constexpr size_t maxTimeLength = 10;
 
 
+	// Clocks that can be used instead of std::chrono::high_resolution_clock
+
+#if defined(__x86_64__) || defined(__i386__)
+	// Time stamp counter, cycles are converted to nanoseconds with the frequency
+	// measured against std::chrono::steady_clock on the first call (takes 10ms).
+	// Fenced version waits for previous instructions and keeps later ones from starting early
+	struct __tsc_calibration { uint64_t base; double nanoseconds; };
+	__tsc_calibration __calibrate()
+	{
+		auto start = std::chrono::steady_clock::now();
+		uint64_t base = __rdtsc();
+		while(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(10));
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		return {base, elapsed.count() / double(__rdtsc() - base)};
+	}
+
+	template<bool Fenced>
+	struct __tsc_clock
+	{
+		using rep = int64_t;
+		using period = std::nano;
+		using duration = std::chrono::duration<rep, period>;
+		using time_point = std::chrono::time_point<__tsc_clock>;
+		static constexpr bool is_steady = true;
+
+		static uint64_t cycles()
+		{
+			if constexpr (not Fenced) return __rdtsc();
+			unsigned int core;
+			uint64_t cycles = __rdtscp(&core);
+			_mm_lfence();
+			return cycles;
+		}
+
+		static time_point now()
+		{
+			static const __tsc_calibration calibration = __calibrate();
+			return time_point(duration(rep(double(cycles() - calibration.base) * calibration.nanoseconds)));
+		}
+	};
+	using tsc_clock = __tsc_clock<false>;
+	using fenced_tsc_clock = __tsc_clock<true>;
+#endif
+
+#ifdef CLOCK_MONOTONIC_COARSE
+	// Updated once per scheduler tick (usually 1-4ms), but is the cheapest to read
+	struct coarse_clock
+	{
+		using duration = std::chrono::nanoseconds;
+		using rep = duration::rep;
+		using period = duration::period;
+		using time_point = std::chrono::time_point<coarse_clock>;
+		static constexpr bool is_steady = true;
+
+		static time_point now()
+		{
+			timespec time;
+			clock_gettime(CLOCK_MONOTONIC_COARSE, &time);
+			return time_point(std::chrono::seconds(time.tv_sec) + std::chrono::nanoseconds(time.tv_nsec));
+		}
+	};
+#endif
+
+#ifdef CLOCK
+	using clock = CLOCK;
+#else
 	using clock = std::chrono::high_resolution_clock;
-	
+#endif
+
+	// Bump allocator for timers and their names. Memory is
+	// freed all at once by reset() and reused afterwards
+	class Arena
+	{
+		static constexpr size_t blockSize = 64*1024;
+		std::vector<std::pair<std::unique_ptr<char[]>, size_t>> blocks;
+		size_t block = 0;
+		size_t used = 0;
+
+	public:
+		void* allocate(size_t size, size_t align)
+		{
+			used = (used + align - 1) & ~(align - 1);
+			while(block < blocks.size() && used + size > blocks[block].second) { block++; used = 0; }
+			if(block == blocks.size())
+			{
+				size_t capacity = std::max(size, blockSize);
+				blocks.emplace_back(std::make_unique<char[]>(capacity), capacity);
+			}
+
+			void* memory = blocks[block].first.get() + used;
+			used += size;
+			return memory;
+		}
+
+		template<typename T, typename... Args>
+		T* make(Args&&... args) { return new(allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...); }
+
+		std::string_view copy(std::string_view s)
+		{
+			if(s.empty()) return s;
+			char* memory = static_cast<char*>(allocate(s.size(), 1));
+			std::memcpy(memory, s.data(), s.size());
+			return std::string_view(memory, s.size());
+		}
+
+		// Destructors are not called, objects in the arena should only own arena memory
+		void reset() { block = 0; used = 0; }
+	};
+
+	// Relaxed atomic value that is written only by the thread that owns it,
+	// so that snapshot() can read timers of other threads while they record
+	template<typename T>
+	class __relaxed
+	{
+		std::atomic<T> value;
+
+	public:
+		__relaxed(T v = T()) : value(v) {}
+		__relaxed(const __relaxed& other) : value(T(other)) {}
+		__relaxed& operator=(const __relaxed& other) { return *this = T(other); }
+
+		operator T() const { return value.load(std::memory_order_relaxed); }
+		__relaxed& operator=(T v) { value.store(v, std::memory_order_relaxed); return *this; }
+		__relaxed& operator+=(T v) { return *this = T(*this) + v; }
+		__relaxed& operator-=(T v) { return *this = T(*this) - v; }
+	};
+
+	// Resource usage (see USAGE), hardware counters (see COUNTERS) and heap usage (see ALLOCATIONS)
+	// of the current thread, summed over calls of a timer, except peak heap usage that is the maximum
+	enum { cpuTime, voluntarySwitches, involuntarySwitches, minorFaults, majorFaults };
+	enum { cycles, instructions, cacheMisses, branchMisses, llcMisses };
+	enum { heapBytes, heapAllocations, heapPeak };
+#ifdef USAGE
+	constexpr size_t resources = 5;
+#else
+	constexpr size_t resources = 0;
+#endif
+#ifdef COUNTERS
+	constexpr size_t counters = 5;
+#else
+	constexpr size_t counters = 0;
+#endif
+#ifdef ALLOCATIONS
+	constexpr size_t allocations = 3;
+#else
+	constexpr size_t allocations = 0;
+#endif
+	constexpr size_t usages = resources + counters + allocations;
+	using Usages = std::array<uint64_t, usages>;
+
+	constexpr bool __maximum(size_t u) { return u == resources + counters + heapPeak; }
+	void __accumulate(uint64_t& into, uint64_t value, size_t u) { into = __maximum(u) ? std::max(into, value) : into + value; }
+
+	// Heap usage of the current thread, counted by operator new and delete. Memory freed
+	// by another thread than the one that allocated it makes live bytes of the threads skewed
+	thread_local uint64_t __heapBytes = 0, __heapAllocations = 0;
+	thread_local int64_t __heapLive = 0, __heapPeak = 0;
+	thread_local std::vector<int64_t> heapPeaks; // Of the outer timers
+
+	// Allocations of the library itself (timers, histograms, stacks) are not counted
+	thread_local uint32_t __heapIgnored = 0;
+	struct __Untracked
+	{
+#ifdef ALLOCATIONS
+		__Untracked() { __heapIgnored++; }
+		~__Untracked() { __heapIgnored--; }
+#endif
+	};
+
+#ifdef COUNTERS
+	// Per-thread group of perf events, events that can not be opened (e.g. restricted by
+	// perf_event_paranoid, missing in a VM) stay zero
+	class __Counters
+	{
+		int group = -1;
+		int fds[counters];
+		size_t slots[counters]; // Position of the event in the group read, counters if not opened
+		size_t opened = 0;
+
+	public:
+		__Counters()
+		{
+			std::pair<uint32_t, uint64_t> events[counters] = {
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+				{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+				{PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+				{PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16}};
+			for(size_t c = 0; c < counters; c++)
+			{
+				perf_event_attr attributes = {};
+				attributes.size = sizeof(attributes);
+				attributes.type = events[c].first;
+				attributes.config = events[c].second;
+				attributes.read_format = PERF_FORMAT_GROUP;
+				attributes.exclude_kernel = 1;
+				attributes.exclude_hv = 1;
+				fds[c] = syscall(SYS_perf_event_open, &attributes, 0, -1, group, 0);
+				slots[c] = fds[c] < 0 ? counters : opened++;
+				if(group < 0) group = fds[c];
+			}
+		}
+
+		~__Counters() { for(int fd: fds) if(fd >= 0) close(fd); }
+
+		bool available() const { return group >= 0; }
+
+		void read(uint64_t* values) const
+		{
+			uint64_t group[1 + counters] = {};
+			if(not available() || ::read(this->group, group, sizeof(group)) <= 0) return;
+			for(size_t c = 0; c < counters; c++) if(slots[c] < counters) values[c] = group[1 + slots[c]];
+		}
+	};
+	thread_local __Counters perfCounters;
+#endif
+
+	Usages __usage()
+	{
+		[[maybe_unused]] Usages usage = {};
+#ifdef USAGE
+		timespec cpu;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+		rusage thread;
+		getrusage(RUSAGE_THREAD, &thread);
+		usage[cpuTime] = uint64_t(cpu.tv_sec) * 1000000000 + cpu.tv_nsec;
+		usage[voluntarySwitches] = thread.ru_nvcsw;
+		usage[involuntarySwitches] = thread.ru_nivcsw;
+		usage[minorFaults] = thread.ru_minflt;
+		usage[majorFaults] = thread.ru_majflt;
+#endif
+#ifdef COUNTERS
+		perfCounters.read(usage.data() + resources);
+#endif
+#ifdef ALLOCATIONS
+		usage[resources + counters + heapBytes] = __heapBytes;
+		usage[resources + counters + heapAllocations] = __heapAllocations;
+		usage[resources + counters + heapPeak] = __heapPeak;
+#endif
+		return usage;
+	}
+
+	// Starts tracking the peak of the timer, whose start usage then holds the live bytes
+	void __heapStart([[maybe_unused]] Usages& start)
+	{
+#ifdef ALLOCATIONS
+		heapPeaks.push_back(__heapPeak);
+		__heapPeak = __heapLive;
+		start[resources + counters + heapPeak] = __heapLive;
+#endif
+	}
+
+	void __heapStop()
+	{
+#ifdef ALLOCATIONS
+		__heapPeak = std::max(__heapPeak, heapPeaks.back());
+		heapPeaks.pop_back();
+#endif
+	}
+
+	// Log-linear histogram of durations in clock ticks: every power of two range
+	// is split into 16 buckets, so percentiles are within ~6% of the real value
+	struct Histogram
+	{
+		static constexpr size_t bits = 4;
+		static constexpr size_t size = (64 - bits + 1) << bits;
+		__relaxed<uint64_t> counts[size];
+
+		static size_t bucket(uint64_t ticks)
+		{
+			if(ticks < (1u << bits)) return ticks;
+			size_t exponent = 63 - __builtin_clzll(ticks);
+			return ((exponent - bits + 1) << bits) + ((ticks >> (exponent - bits)) & ((1u << bits) - 1));
+		}
+
+		// Middle of the bucket
+		static uint64_t value(size_t bucket)
+		{
+			if(bucket < (1u << bits)) return bucket;
+			size_t exponent = (bucket >> bits) + bits - 1;
+			uint64_t low = (uint64_t(1) << exponent) + (uint64_t(bucket & ((1u << bits) - 1)) << (exponent - bits));
+			return low + (uint64_t(1) << (exponent - bits)) / 2;
+		}
+
+		void add(clock::duration duration, uint64_t n = 1) { counts[bucket(std::max<clock::rep>(duration.count(), 0))] += n; }
+		void add(const Histogram& other) { for(size_t i = 0; i < size; i++) counts[i] += other.counts[i]; }
+
+		clock::duration percentile(double p, size_t count) const
+		{
+			uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(p / 100.0 * count))), seen = 0;
+			for(size_t i = 0; i < size; i++) if((seen += counts[i]) >= rank) return clock::duration(value(i));
+			return clock::duration::max();
+		}
+	};
+
+	// FNV-1a
+	constexpr uint64_t __hash(std::string_view s)
+	{
+		uint64_t hash = 14695981039346656037ull;
+		for(char c: s) { hash ^= uint8_t(c); hash *= 1099511628211ull; }
+		return hash;
+	}
+
+	// Name of a timer with its hash, timers are found by the hash only (see AGGREGATE).
+	// constexpr names are hashed at compile time and string literals in Scope once per call site,
+	// other names (also literals given to Start) on every call. For hot Start/Stop use e.g.
+	// static constexpr Timer::Name Parse = "Parse"; Timer::Start(Parse);
+	struct Name
+	{
+		std::string_view text;
+		uint64_t hash;
+
+		constexpr Name(std::string_view s = "") : text(s), hash(__hash(s)) {}
+		template<size_t N> constexpr Name(const char (&s)[N]) : Name(std::string_view(s)) {}
+	};
+
 	// Tree structure for timers
 	struct Timer
 	{
-		std::string name = "";
-		clock::duration time;
+		std::string_view name = "";
+		uint64_t hash = __hash("");
 		size_t depth = 0;
-
 		Timer* parent = nullptr;
-		std::vector<Timer*> children;
+		Arena* arena;
+
+		// Children are a linked list, so that other threads can read it while timers are appended
+		std::atomic<Timer*> child = nullptr;
+		std::atomic<Timer*> next = nullptr;
+		Timer* last = nullptr;
 
-		Timer() {};
-		Timer(Timer* p, std::string s) : name(s), depth(p->depth + 1), parent(p) {};
+		// Measurements, recorded by the owning thread under the seqlock `version` (odd while recording)
+		std::atomic<uint32_t> version = 0;
+		__relaxed<clock::duration> time = clock::duration::zero(); // Total over all calls
+		__relaxed<clock::duration> min = clock::duration::max();
+		__relaxed<clock::duration> max = clock::duration::zero();
+		__relaxed<clock::time_point> start; // Of the first call
+		__relaxed<uint64_t> count = 0;
+
+		// Welford's running mean and sum of squared deviations (in clock ticks),
+		// histogram is allocated on the second call
+		__relaxed<double> mean = 0.0;
+		__relaxed<double> m2 = 0.0;
+		__relaxed<Histogram*> histogram = nullptr;
+		std::array<__relaxed<uint64_t>, usages> usage;
+
+		Timer(Arena* a) : arena(a) {}
+		Timer(Timer* p, const Name& n) : name(n.text), hash(n.hash), depth(p->depth + 1), parent(p), arena(p->arena) {}
+
+		Timer* firstChild() const { return child.load(std::memory_order_acquire); }
+		Timer* nextSibling() const { return next.load(std::memory_order_acquire); }
+
+		void append(Timer* timer)
+		{
+			(last ? last->next : child).store(timer, std::memory_order_release);
+			last = timer;
+		}
+
+		// Pre-order traversal without recursion. Children are pushed when leaving
+		// the timer, so they can be reordered while it is visited
+		class iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = Timer;
+			using difference_type = std::ptrdiff_t;
+			using pointer = Timer*;
+			using reference = Timer&;
+
+		private:
+			std::vector<Timer*> stack;
+			Timer* current;
+
+		public:
+			iterator(Timer* timer = nullptr) : current(timer) {}
+			reference operator*() const { return *current; }
+			pointer operator->() const { return current; }
+
+			iterator& operator++()
+			{
+				size_t size = stack.size();
+				for(Timer* child = current->firstChild(); child; child = child->nextSibling()) stack.push_back(child);
+				std::reverse(stack.begin() + size, stack.end());
+				if(stack.empty()) { current = nullptr; return *this; }
+				current = stack.back(); stack.pop_back();
+				return *this;
+			}
+
+			iterator operator++(int) { iterator tmp = *this; ++(*this); return tmp; }
+			bool operator==(const iterator& other) const { return current == other.current; }
+			bool operator!=(const iterator& other) const { return !(*this == other); }
+		};
+
+		iterator begin() { return iterator(this); }
+		iterator end() { return iterator(); }
 	};
 	
-	Timer* tree = new Timer();
-	Timer* timer = tree;
+	// Trees of all threads that used timers
+	std::mutex treesMutex;
+	std::vector<Timer*> trees;
 
-	// Main measurement functions
-	std::stack<std::chrono::time_point<clock>> starts;
-	void Start(std::string name = "")
+	Timer* newTree(Arena* arena)
 	{
-		maxNameLength = std::max(name.size(), maxNameLength);
-		timer->children.push_back(new Timer(timer, name));
-		timer = timer->children.back();
-
-		starts.push(clock::now());
+		std::lock_guard<std::mutex> lock(treesMutex);
+		trees.push_back(new Timer(arena));
+		return trees.back();
 	}
 
-	void Stop()
+	// Every thread measures into its own tree, so Start/Stop need no locks
+	thread_local Arena* arena = new Arena();
+	thread_local Timer* tree = newTree(arena);
+	thread_local Timer* timer = tree;
+
+	// Makes the timer current until the end of the scope, also when an exception is thrown
+	struct __Within
 	{
-#ifdef SAFE
-		if(starts.empty()) {std::cerr << RED << "Error: no timers to stop" << std::endl; return; };
+		Timer* saved;
+		__Within(Timer* t) : saved(std::exchange(timer, t)) {}
+		~__Within() { timer = saved; }
+	};
+
+	// Finds (AGGREGATE) or creates the child timer with the name
+	Timer* __child(Timer* parent, const Name& name, bool copy)
+	{
+#ifdef AGGREGATE
+		for(Timer* child = parent->firstChild(); child; child = child->nextSibling()) if(child->hash == name.hash) return child;
 #endif
-		auto duration = clock::now() - starts.top();
-		starts.pop();
-			
-		maxDepth = std::max(timer->depth, maxDepth);
-		timer->time = duration;
-		timer = timer->parent;
+		[[maybe_unused]] __Untracked untracked;
+		Timer* child = parent->arena->make<Timer>(parent, name);
+		if(copy) child->name = parent->arena->copy(name.text);
+		parent->append(child);
+		return child;
+	}
 
+	// Child of the current timer cached per call site (Site) and thread, so that entering it again
+	// from the same parent needs no lookup (AGGREGATE). reset() invalidates the cache by the generation
+	thread_local uint32_t generation = 0;
+
+	template<size_t Site, size_t N>
+	Timer* __cached(const char (&name)[N])
+	{
+		static thread_local struct { Timer* parent = nullptr; Timer* child = nullptr; uint32_t generation = 0; } slot;
+		if(slot.parent != timer || slot.generation != generation)
+		{
+			static const Name site(name);
+			slot = {timer, __child(timer, site, false), generation};
+		}
+		return slot.child;
 	}
 
-	// Measuring in scope. Construction (destruction)
-	// corresponds to starting (stopping) the measuremsent
-	#define Scope __Scope __measurement
-	class __Scope
+	// Records a call, a sampled call counts `weight` times
+	void __record(Timer* timer, clock::time_point start, clock::duration duration, uint64_t weight = 1, const Usages& usage = {})
 	{
-	public:	
-		__Scope(std::string name = "") { Start(name); }
-		~__Scope() { Stop(); }
+		uint32_t version = timer->version.load(std::memory_order_relaxed);
+		timer->version.store(version + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		// Histogram is allocated on the second call, the first one is the total time then
+		if(timer->count + weight > 1 && not timer->histogram)
+		{
+			[[maybe_unused]] __Untracked untracked;
+			Histogram* histogram = timer->arena->make<Histogram>();
+			if(timer->count) histogram->add(timer->time);
+			timer->histogram = histogram;
+		}
+		if(Histogram* histogram = timer->histogram) histogram->add(duration, weight);
+
+		if(timer->count == 0) timer->start = start;
+		timer->time += duration * static_cast<clock::rep>(weight);
+		timer->min = std::min<clock::duration>(timer->min, duration);
+		timer->max = std::max<clock::duration>(timer->max, duration);
+		timer->count += weight;
+
+		double delta = duration.count() - timer->mean;
+		timer->mean += delta * weight / timer->count;
+		timer->m2 += delta * weight * (duration.count() - timer->mean);
+		for(size_t u = 0; u < usages; u++)
+		{
+			uint64_t value = timer->usage[u];
+			__accumulate(value, __maximum(u) ? usage[u] : usage[u] * weight, u);
+			timer->usage[u] = value;
+		}
+
+		timer->version.store(version + 2, std::memory_order_release);
+	}
+
+	// Consistent copy of the measurements of a timer
+	struct Sample
+	{
+		clock::time_point start;
+		clock::duration time = clock::duration::zero();
+		clock::duration min = clock::duration::max();
+		clock::duration max = clock::duration::zero();
+		uint64_t count = 0;
+		double mean = 0.0;
+		double m2 = 0.0;
+		Histogram* histogram = nullptr;
+		Usages usage = {};
 	};
-	
 
+	// Copies measurements of a timer that its thread may be recording, the histogram is copied
+	// to the given one after the other values, so it may be off by the calls recorded meanwhile.
+	// A timer recorded faster than it is read is copied torn after some retries
+	Sample __sample(const Timer* timer, Histogram& histogram)
+	{
+		Sample sample;
+		for(size_t retries = 0;; retries++)
+		{
+			uint32_t version = timer->version.load(std::memory_order_acquire);
+			bool torn = retries >= 1000;
+			if((version & 1) && not torn) { std::this_thread::yield(); continue; }
+
+			sample.start = timer->start;
+			sample.time = timer->time;
+			sample.min = timer->min;
+			sample.max = timer->max;
+			sample.count = timer->count;
+			sample.mean = timer->mean;
+			sample.m2 = timer->m2;
+			sample.histogram = timer->histogram;
+			for(size_t u = 0; u < usages; u++) sample.usage[u] = timer->usage[u];
 
-	void sort(Timer* timer)
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if(torn || timer->version.load(std::memory_order_relaxed) == version) break;
+		}
+		if(sample.histogram) sample.histogram = &(histogram = *sample.histogram);
+		return sample;
+	}
+
+	// Event of the trace mode, see below
+	struct Event
+	{
+		enum : uint32_t { start, stop };
+		int64_t time; // Nanoseconds since clock epoch
+		uint32_t name;
+		uint32_t type;
+	};
+
+#ifdef TRACE
+	// Trace mode: Start/Stop append fixed-size events to a per-thread ring buffer
+	// instead of building the tree. Full buffers are written to the trace file
+	// (see trace()) by the recording thread, or earlier by the background flusher.
+	// load() rebuilds the trees from the file, so that they can be printed
+	// Single producer (recording thread), consumers are serialized by traceMutex
+	class Buffer
+	{
+		std::unique_ptr<Event[]> events;
+		size_t capacity;
+		std::atomic<size_t> head = 0;
+		std::atomic<size_t> tail = 0;
+
+	public:
+		uint32_t thread;
+		std::unordered_map<uint64_t, uint32_t> ids; // Cache of name ids by hash, used by the recording thread only
+
+		Buffer(uint32_t t, size_t c) : events(new Event[c]), capacity(c), thread(t) {}
+
+		void push(const Event& event);
+
+		// Moves recorded events to the vector
+		void drain(std::vector<Event>& out)
+		{
+			size_t begin = tail.load(std::memory_order_relaxed), end = head.load(std::memory_order_acquire);
+			for(size_t i = begin; i < end; i++) out.push_back(events[i % capacity]);
+			tail.store(end, std::memory_order_release);
+		}
+
+		bool full() const { return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_acquire) == capacity; }
+		void write(const Event& event)
+		{
+			size_t h = head.load(std::memory_order_relaxed);
+			events[h % capacity] = event;
+			head.store(h + 1, std::memory_order_release);
+		}
+	};
+
+	size_t bufferCapacity = 1 << 16; // Events per thread, set before threads start timers
+	std::mutex traceMutex;
+	std::vector<Buffer*> buffers;
+	std::deque<std::string> names; // Name of every id, deque keeps them in place
+	std::unordered_map<std::string_view, uint32_t> ids;
+	std::FILE* traceFile = nullptr;
+	size_t namesWritten = 0;
+	size_t lost = 0; // Events dropped because the buffer was full and there was no trace file
+
+	Buffer* newBuffer()
 	{
-		std::sort(timer->children.begin(), timer->children.end(), [](const auto& a, const auto& b) { return a->time > b->time; });
-		for(auto child: timer->children) sort(child);
+		std::lock_guard<std::mutex> lock(traceMutex);
+		buffers.push_back(new Buffer(buffers.size(), bufferCapacity));
+		return buffers.back();
 	}
-	
-	// Converts one measurement to string 
-	template<typename time_t, typename... Options>
-	std::string string(Timer* timer)
+	thread_local Buffer* buffer = newBuffer();
+
+	uint32_t __id(const Name& name, Buffer* buffer)
 	{
-		std::stringstream stream;
-		
-		if(timer != tree)
+		auto found = buffer->ids.find(name.hash);
+		if(found != buffer->ids.end()) return found->second;
+
+		std::lock_guard<std::mutex> lock(traceMutex);
+		auto id = ids.find(name.text);
+		if(id == ids.end())
 		{
-			// Timer depth
-			if isOption(Color, Options) stream << DIM;
-			for(size_t i = 0; i < timer->depth - 1; i++) stream << "| ";
-			stream << RESET;
-		
-			// Timer name
-			size_t depthLength = 3; if isOption(Color, Options) depthLength++;
-			if isOption(Align, Options) stream << std::left << std::setw(maxNameLength + depthLength*maxDepth - stream.tellp());
-			stream << timer->name + ": ";
-			
-			// Time measured in time_t
-			if isOption(Color, Options) stream << CYAN;
-			if isOption(Align, Options) stream << std::right << std::setw(maxTimeLength);
-			stream << std::chrono::duration_cast<time_t>(timer->time).count();
-			stream << RESET << units<time_t>();
-		
-			// Percentage
-			double percentage = 100.0 * timer->time / timer->parent->time;
-			if isOption(Color, Options) stream << percentageColor(percentage);
-			if isOption(Percentage, Options) stream << "\t\t" << percentage << "%";	
-			stream << RESET;
+			names.emplace_back(name.text);
+			id = ids.emplace(names.back(), names.size() - 1).first;
+		}
+		return buffer->ids.emplace(name.hash, id->second).first->second;
+	}
 
-			stream << std::endl;
+	// Writes new names and events of the buffers to the trace file, traceMutex has to be locked.
+	// Events are drained before names are written, so that the names of all events are in the file
+	void __flush(const std::vector<Buffer*>& flushed)
+	{
+		if(not traceFile)
+		{
+			std::vector<Event> events;
+			for(auto buffer: flushed) { buffer->drain(events); lost += events.size(); events.clear(); }
+			return;
 		}
 
-		for(auto child: timer->children) stream << string<time_t, Options...>(child);
-		
-		return stream.str();
+		std::vector<std::vector<Event>> events(flushed.size());
+		for(size_t i = 0; i < flushed.size(); i++) flushed[i]->drain(events[i]);
+
+		for(; namesWritten < names.size(); namesWritten++)
+		{
+			uint32_t header[3] = {'N', uint32_t(namesWritten), uint32_t(names[namesWritten].size())};
+			std::fwrite(header, sizeof(header), 1, traceFile);
+			std::fwrite(names[namesWritten].data(), 1, names[namesWritten].size(), traceFile);
+		}
+		for(size_t i = 0; i < flushed.size(); i++)
+		{
+			if(events[i].empty()) continue;
+			uint32_t header[3] = {'E', flushed[i]->thread, uint32_t(events[i].size())};
+			std::fwrite(header, sizeof(header), 1, traceFile);
+			std::fwrite(events[i].data(), sizeof(Event), events[i].size(), traceFile);
+		}
+		std::fflush(traceFile);
 	}
 
-	// Main function that converts measurements to string
-	template<typename... Options>
-	std::string string()
+	void Buffer::push(const Event& event)
 	{
-		if(not starts.empty()) return RED + "Error: Not all timers have stopped"; 
+		if(full()) { std::lock_guard<std::mutex> lock(traceMutex); __flush({this}); }
+		write(event);
+	}
 
-		using time_t = get_time_t<std::chrono::milliseconds, Options...>;
-		
-		if isOption(Sort, Options) sort(tree);
+	void flush()
+	{
+		std::lock_guard<std::mutex> lock(traceMutex);
+		__flush(buffers);
+	}
 
-		if isOption(Percentage, Options)
-			tree->time = std::accumulate(tree->children.begin(), tree->children.end(), clock::duration::zero(), 
-					[](const auto& acc, const auto& child){ return acc + child->time; });
-		
-		return string<time_t, Options...>(tree);
+	// Flushes the buffers every interval in the background, and once more at exit
+	class __Flusher
+	{
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool stopped = false;
+
+	public:
+		void start(std::chrono::milliseconds interval)
+		{
+			stop();
+			stopped = false;
+			thread = std::thread([this, interval]{
+				std::unique_lock<std::mutex> lock(mutex);
+				while(not wake.wait_for(lock, interval, [this]{ return stopped; })) flush();
+			});
+		}
+
+		void stop()
+		{
+			if(not thread.joinable()) return;
+			{ std::lock_guard<std::mutex> lock(mutex); stopped = true; }
+			wake.notify_one();
+			thread.join();
+		}
+
+		~__Flusher()
+		{
+			stop();
+			flush();
+			if(traceFile) std::fclose(traceFile);
+		}
+	} flusher;
+
+	// Starts writing the trace to the file, with a nonzero interval buffers are also flushed in the background
+	bool trace(const std::string& path, std::chrono::milliseconds interval = std::chrono::milliseconds(0))
+	{
+		flusher.stop();
+		{
+			std::lock_guard<std::mutex> lock(traceMutex);
+			if(traceFile) { __flush(buffers); std::fclose(traceFile); }
+			traceFile = std::fopen(path.c_str(), "wb");
+			if(not traceFile) return false;
+			std::fwrite("TIMERTRC", 1, 8, traceFile);
+			namesWritten = 0;
+		}
+		if(interval.count() > 0) flusher.start(interval);
+		return true;
 	}
-	
-}
+#endif
+
+	// Bytes left to read, sizes read from a file are checked against it before allocating
+	size_t __remaining(std::FILE* file)
+	{
+		long position = std::ftell(file);
+		if(position < 0 || std::fseek(file, 0, SEEK_END) != 0) return 0;
+		long end = std::ftell(file);
+		std::fseek(file, position, SEEK_SET);
+		return end > position ? end - position : 0;
+	}
+
+	// Rebuilds the trees from a trace file written in trace mode, one tree per recorded thread
+	bool load(const std::string& path)
+	{
+		std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(path.c_str(), "rb"), std::fclose);
+		char magic[8];
+		if(not file || std::fread(magic, 1, 8, file.get()) != 8 || std::string_view(magic, 8) != "TIMERTRC") return false;
+
+		struct Replay { Timer* timer; std::vector<int64_t> starts; };
+		std::unordered_map<uint32_t, Replay> threads;
+		Arena* arena = new Arena();
+		std::vector<std::string_view> names;
+
+		uint32_t header[3];
+		while(std::fread(header, sizeof(header), 1, file.get()) == 1)
+		{
+			if(header[0] == 'N')
+			{
+				// Names are written in the order of their ids
+				if(header[1] > names.size() || header[2] > __remaining(file.get())) return false;
+				std::string name(header[2], '\0');
+				if(std::fread(name.data(), 1, name.size(), file.get()) != name.size()) return false;
+				names.resize(std::max<size_t>(names.size(), header[1] + 1));
+				names[header[1]] = arena->copy(name);
+				continue;
+			}
+
+			if(header[0] != 'E' || header[2] > __remaining(file.get()) / sizeof(Event)) return false;
+			std::vector<Event> events(header[2]);
+			if(std::fread(events.data(), sizeof(Event), events.size(), file.get()) != events.size()) return false;
+
+			auto [replay, inserted] = threads.try_emplace(header[1]);
+			if(inserted) replay->second.timer = newTree(arena);
+			Replay& thread = replay->second;
+			for(const auto& event: events)
+			{
+				if(event.type == Event::start)
+				{
+					thread.timer = __child(thread.timer, Name(event.name < names.size() ? names[event.name] : ""), false);
+					thread.starts.push_back(event.time);
+				}
+				else if(not thread.starts.empty())
+				{
+					auto start = clock::time_point(std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(thread.starts.back())));
+					__record(thread.timer, start, std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds(event.time - thread.starts.back())));
+					thread.starts.pop_back();
+					thread.timer = thread.timer->parent;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Main measurement functions
+	thread_local std::stack<std::chrono::time_point<clock>, std::vector<std::chrono::time_point<clock>>> starts;
+	thread_local std::vector<Usages> usageStarts;
+	void __enter(Timer* child)
+	{
+		[[maybe_unused]] __Untracked untracked;
+		timer = child;
+		if constexpr (usages > 0) __heapStart(usageStarts.emplace_back(__usage()));
+		starts.push(clock::now());
+	}
+
+	void __start(const Name& name, [[maybe_unused]] bool copy)
+	{
+#ifdef TRACE
+		buffer->push({std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count(), __id(name, buffer), Event::start});
+#else
+		__enter(__child(timer, name, copy));
+#endif
+	}
+
+	// Starts the timer of a call site with a literal name
+	template<size_t Site, size_t N>
+	void __startSite(const char (&name)[N])
+	{
+#if defined(TRACE)
+		static const uint32_t id = __id(Name(name), buffer); // Ids are the same in all threads
+		buffer->push({std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count(), id, Event::start});
+#elif defined(AGGREGATE)
+		__enter(__cached<Site>(name));
+#else
+		static const Name site(name);
+		__start(site, false);
+#endif
+	}
+
+	// Records the current timer and returns to its parent
+	void __leave(uint64_t weight = 1)
+	{
+		auto duration = clock::now() - starts.top();
+		Usages usage = {};
+		if constexpr (usages > 0)
+		{
+			usage = __usage();
+			for(size_t u = 0; u < usages; u++) usage[u] -= usageStarts.back()[u];
+			usageStarts.pop_back();
+			__heapStop();
+		}
+		__record(timer, starts.top(), duration, weight, usage);
+		starts.pop();
+
+		timer = timer->parent;
+	}
+
+	void __stop([[maybe_unused]] uint64_t weight = 1)
+	{
+#ifdef TRACE
+		buffer->push({std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count(), 0, Event::stop});
+#else
+#ifdef SAFE
+		if(starts.empty()) {std::cerr << RED << "Error: no timers to stop" << std::endl; return; };
+#endif
+		__leave(weight);
+#endif
+	}
+
+	// Timers of disabled categories (see CATEGORIES, DISABLE) compile to nothing.
+	// Names are stored without copying, other names (also char arrays, that may be overwritten) are copied once per timer
+	template<Category category = all, size_t N> void Start(const char (&name)[N]) { if constexpr (enabled(category)) __start(Name(name), true); }
+	template<Category category = all> void Start(const Name& name) { if constexpr (enabled(category)) __start(name, false); }
+	template<Category category = all> void Start(std::string_view name = "") { if constexpr (enabled(category)) __start(Name(name), true); }
+	template<Category category = all> void Stop() { if constexpr (enabled(category)) __stop(); }
+
+	// Measuring in scope. Construction (destruction)
+	// corresponds to starting (stopping) the measuremsent.
+	// A string literal name is hashed once per call site (Site), with AGGREGATE its timer is cached.
+	// Other names (e.g. char arrays) have no site and are copied
+#if defined(__GNUC__)
+	#define __site(...) (__builtin_constant_p(__VA_ARGS__) ? __COUNTER__ + 1 : 0)
+#else
+	#define __site(...) 0
+#endif
+	#define Scope(...) __Scope<::Timer::all, __site(__VA_ARGS__)> __measurement(__VA_ARGS__)
+	#define ScopeIn(category) __Scope<category> __measurement
+	template<Category category = all, size_t Site = 0>
+	class __Scope
+	{
+	public:	
+		template<size_t N> __Scope(const char (&name)[N])
+		{
+			if constexpr (Site == 0 || not enabled(category)) Start<category>(name);
+			else __startSite<Site>(name);
+		}
+		__Scope(const Name& name) { Start<category>(name); }
+		__Scope(std::string_view name = "") { Start<category>(name); }
+		~__Scope() { Stop<category>(); }
+	};
+
+	// Measuring every N-th entry of the scope, the measured entry counts N times.
+	// Other entries only decrement and check the counter of the call site (and thread).
+	// RandomScope measures entries at random intervals (N on average) to avoid aliasing with loops.
+	// In TRACE mode sampled entries are not scaled
+	#define SampledScope(n) __SampledScope<n, false, __COUNTER__> __measurement
+	#define RandomScope(n) __SampledScope<n, true, __COUNTER__> __measurement
+	uint32_t __random()
+	{
+		thread_local uint32_t state = 2463534242u; // xorshift32
+		state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+		return state;
+	}
+
+	template<uint32_t N, bool Random, size_t Site>
+	class __SampledScope
+	{
+		static_assert(N > 0, "Sampling interval has to be positive");
+		static inline thread_local uint32_t countdown = 1;
+		bool sampled = false;
+
+		bool sample()
+		{
+			if(--countdown != 0) return false;
+			countdown = Random ? 1 + __random() % (2*N - 1) : N;
+			return true;
+		}
+
+	public:
+		template<size_t M> __SampledScope(const char (&name)[M]) { if constexpr (enabled(all)) if((sampled = sample())) __start(Name(name), true); }
+		__SampledScope(const Name& name) { if constexpr (enabled(all)) if((sampled = sample())) __start(name, false); }
+		__SampledScope(std::string_view name = "") { if constexpr (enabled(all)) if((sampled = sample())) __start(Name(name), true); }
+		~__SampledScope() { if constexpr (enabled(all)) if(sampled) __stop(N); }
+	};
+
+	// Timer of a logical task (e.g. a request or a coroutine) that is suspended and resumed,
+	// possibly on other threads. The task is recorded on the thread that finishes it with its wall
+	// time and a child "(active)" with the time it was running, and its usage (e.g. CPU time with
+	// USAGE) then. Timers started while the task runs are nested in "(active)" on every thread,
+	// so the self time of the task is the time it was suspended.
+	// Timers started in the task have to be stopped before it is suspended. Tasks are not traced (TRACE)
+	class Task
+	{
+		std::vector<std::string> path; // Names from the root to the task
+		clock::time_point start, resumed;
+		clock::duration active = clock::duration::zero();
+		Usages resumedUsage = {}, usage = {};
+		Timer* saved = nullptr; // Timer of the thread running the task, while it runs
+		bool finished = false;
+
+		// Finds or creates the child (also without AGGREGATE, a task is one timer per thread)
+		static Timer* find(Timer* parent, const Name& name)
+		{
+			Timer* child = parent->firstChild();
+			while(child && child->hash != name.hash) child = child->nextSibling();
+			return child ? child : __child(parent, name, true);
+		}
+
+		// Timer of the task in the tree of the current thread
+		Timer* node() const
+		{
+			Timer* current = tree;
+			for(auto& name: path) current = find(current, Name(name));
+			return current;
+		}
+
+	public:
+		// Starts the task in the current timer, it is not running until resumed
+		template<typename String>
+		Task(const String& name)
+		{
+#ifndef TRACE
+			if constexpr (not enabled(all)) return;
+			for(Timer* t = ::Timer::timer; t->parent; t = t->parent) path.emplace_back(t->name);
+			std::reverse(path.begin(), path.end());
+			path.emplace_back(name);
+			start = clock::now();
+#endif
+		}
+		Task(const Task&) = delete;
+		Task& operator=(const Task&) = delete;
+		~Task() { finish(); }
+
+		// Continues the task on the current thread
+		void resume()
+		{
+			if(path.empty() || saved || finished) return;
+			saved = ::Timer::timer;
+			::Timer::timer = find(node(), "(active)");
+			if constexpr (usages > 0) resumedUsage = __usage();
+			resumed = clock::now();
+		}
+
+		// Pauses the task, e.g. before awaiting or passing it to another thread
+		void suspend()
+		{
+			if(not saved) return;
+			active += clock::now() - resumed;
+			if constexpr (usages > 0)
+			{
+				// The peak of live heap bytes is not a sum over the running times
+				Usages now = __usage();
+				for(size_t u = 0; u < usages; u++) if(not __maximum(u)) usage[u] += now[u] - resumedUsage[u];
+			}
+			::Timer::timer = saved;
+			saved = nullptr;
+		}
+
+		// Records the task on the current thread
+		void finish()
+		{
+			if(path.empty() || finished) return;
+			suspend();
+			finished = true;
+			Timer* task = node();
+			__record(task, start, clock::now() - start);
+			__record(find(task, "(active)"), start, active, 1, usage);
+		}
+
+		// Runs the task in the scope, e.g. in a continuation on an executor thread
+		class Running
+		{
+			Task& task;
+		public:
+			Running(Task& t) : task(t) { task.resume(); }
+			~Running() { task.suspend(); }
+		};
+	};
+
+	// Sum of times of the timer children
+	clock::duration total(const Timer* timer)
+	{
+		clock::duration sum = clock::duration::zero();
+		for(Timer* child = timer->firstChild(); child; child = child->nextSibling()) sum += child->time;
+		return sum;
+	}
+
+	// Cost of an empty Start/Stop pair and the part of it that the timer
+	// measures itself (between the clock reads), measured by calibrate()
+	clock::duration overhead = clock::duration::zero();
+	clock::duration selfOverhead = clock::duration::zero();
+	bool calibrated = false;
+
+	clock::duration calibrate(size_t n = 100000)
+	{
+		// Measure into a scratch tree so that measurements are not affected, also not traced (TRACE).
+		// Pairs take the call site cached path of Scope, so that one timer is reused
+		Arena scratch;
+		Timer root(&scratch);
+		Timer* savedTimer = std::exchange(timer, &root);
+
+		for(size_t i = 0; i < n/10; i++) { __enter(__cached<__COUNTER__ + 1>("Calibration")); __leave(); }
+		auto start = clock::now();
+		for(size_t i = 0; i < n; i++) { __enter(__cached<__COUNTER__ + 1>("Calibration")); __leave(); }
+		auto elapsed = clock::now() - start;
+
+		timer = savedTimer;
+		calibrated = true;
+		overhead = elapsed / n;
+		selfOverhead = total(&root) / (n + n/10);
+		return overhead;
+	}
+
+	std::string __json(std::string_view s)
+	{
+		std::string result;
+		for(char c: s)
+		{
+			if(c == '"' || c == '\\') result += '\\';
+			if(static_cast<unsigned char>(c) < 0x20) { char escaped[8]; std::snprintf(escaped, sizeof(escaped), "\\u%04x", c); result += escaped; }
+			else result += c;
+		}
+		return result;
+	}
+
+	// Keeps the compiler from optimizing away the computation of the value
+	template<typename T>
+	void DoNotOptimize(const T& value)
+	{
+#if defined(__GNUC__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		std::atomic_signal_fence(std::memory_order_seq_cst); (void)value;
+#endif
+	}
+
+	// Keeps the compiler from reordering or eliding memory writes across this point
+	inline void ClobberMemory()
+	{
+#if defined(__GNUC__)
+		asm volatile("" : : : "memory");
+#else
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+	}
+
+	// Runs a function in batches of iterations, scaled so that a batch takes about time/batches,
+	// after warming up. Batches further than `outliers` scaled median absolute deviations from the median
+	// are rejected, the others are recorded as calls of the timer `name` (weighted by iterations)
+	// in the current timer, so they can be printed with string<Calls, Mean, Percentiles>().
+	// Timers started by the function are nested in it
+	struct Benchmark
+	{
+		std::string name;
+		clock::duration time, warmup;
+		size_t batches;
+		double outliers;
+
+		// Results per iteration, in nanoseconds
+		size_t iterations = 1; // Per batch
+		size_t rejected = 0;
+		double mean = 0.0, median = 0.0, deviation = 0.0, min = 0.0, max = 0.0;
+
+		Benchmark(std::string_view n, clock::duration t = std::chrono::milliseconds(500), size_t b = 20, 
+			clock::duration w = std::chrono::milliseconds(50), double o = 3.0)
+			: name(n), time(t), warmup(w), batches(std::max<size_t>(b, 1)), outliers(o) {}
+
+		template<typename Function>
+		Benchmark& run(Function function)
+		{
+			auto batch = [&](size_t n)
+			{
+				auto start = clock::now();
+				for(size_t i = 0; i < n; i++) { function(); ClobberMemory(); }
+				return clock::now() - start;
+			};
+
+			Timer* node = __child(timer, Name(name), true);
+			std::vector<std::pair<clock::time_point, clock::duration>> measured;
+			{
+				__Within within(node);
+
+				// Warm-up while scaling iterations up to the batch time
+				clock::duration target = time / batches, spent = clock::duration::zero();
+				for(iterations = 1;;)
+				{
+					clock::duration elapsed = batch(iterations);
+					spent += elapsed;
+					if(elapsed >= target && spent >= warmup) break;
+					if(elapsed < target) 
+					{
+						double scale = elapsed.count() > 0 ? 1.2 * target.count() / elapsed.count() : 10.0;
+						iterations = std::max<size_t>(iterations + 1, iterations * std::min(scale, 10.0));
+					}
+				}
+
+				for(size_t b = 0; b < batches; b++) { auto start = clock::now(); measured.push_back({start, batch(iterations)}); }
+			}
+
+			// Rejection by median absolute deviation
+			auto middle = [](std::vector<double> values)
+			{
+				std::nth_element(values.begin(), values.begin() + values.size()/2, values.end());
+				return values[values.size()/2];
+			};
+			std::vector<double> ns, deviations;
+			for(auto& [start, elapsed]: measured) ns.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / iterations);
+			median = middle(ns);
+			for(double x: ns) deviations.push_back(std::abs(x - median));
+			double limit = outliers * 1.4826 * middle(deviations);
+
+			double sum = 0.0, squares = 0.0;
+			size_t kept = 0;
+			min = std::numeric_limits<double>::max(); max = 0.0;
+			for(size_t b = 0; b < batches; b++)
+			{
+				if(limit > 0.0 && std::abs(ns[b] - median) > limit) continue;
+				__record(node, measured[b].first, measured[b].second / iterations, iterations);
+				sum += ns[b]; squares += ns[b] * ns[b]; kept++;
+				min = std::min(min, ns[b]); max = std::max(max, ns[b]);
+			}
+			rejected = batches - kept;
+			mean = sum / kept;
+			deviation = kept > 1 ? std::sqrt(std::max(0.0, (squares - sum * mean) / (kept - 1))) : 0.0;
+			return *this;
+		}
+
+		std::string json() const
+		{
+			char numbers[256];
+			std::snprintf(numbers, sizeof(numbers), "\"iterations\":%zu,\"batches\":%zu,\"rejected\":%zu,"
+				"\"mean_ns\":%.3f,\"median_ns\":%.3f,\"stddev_ns\":%.3f,\"min_ns\":%.3f,\"max_ns\":%.3f",
+				iterations, batches, rejected, mean, median, deviation, min, max);
+			return "{\"name\":\"" + __json(name) + "\"," + numbers + "}";
+		}
+	};
+
+	// Flat tree used for printing, values of the timer i are at index i of every array.
+	// Timer 0 is the root, children come after their parent, so 0 as child or next means none
+	struct Flat
+	{
+		Arena arena; // Copied names and histograms
+		size_t maxNameLength = 0;
+		size_t maxDepth = 0;
+		std::vector<std::string_view> names;
+		std::unordered_map<std::string_view, uint32_t> ids;
+
+		std::vector<uint32_t> name, depth, parent, child, last, next;
+		std::vector<clock::duration> time, min, max;
+		std::vector<clock::time_point> start;
+		std::vector<uint64_t> count;
+		std::vector<double> mean, m2;
+		std::vector<Histogram*> histogram;
+		std::vector<Usages> usage;
+
+		Flat() { node(0, id("")); }
+		Flat(Flat&&) = default;
+		Flat& operator=(Flat&&) = default;
+
+		// Copies names and histograms into the own arena
+		Flat(const Flat& from) : maxNameLength(from.maxNameLength), maxDepth(from.maxDepth),
+			name(from.name), depth(from.depth), parent(from.parent), child(from.child), last(from.last), next(from.next),
+			time(from.time), min(from.min), max(from.max), start(from.start), count(from.count), mean(from.mean), m2(from.m2),
+			histogram(from.histogram), usage(from.usage)
+		{
+			for(auto& n: from.names) { names.push_back(arena.copy(n)); ids[names.back()] = names.size() - 1; }
+			for(auto& h: histogram) if(h) { Histogram* copy = arena.make<Histogram>(); copy->add(*h); h = copy; }
+		}
+
+		uint32_t size() const { return name.size(); }
+
+		// Names are copied, thread arenas are reused after reset()
+		uint32_t id(std::string_view s)
+		{
+			auto found = ids.find(s);
+			if(found != ids.end()) return found->second;
+			names.push_back(arena.copy(s));
+			return ids[names.back()] = names.size() - 1;
+		}
+
+		// Appends a child to the timer p
+		uint32_t node(uint32_t p, uint32_t n)
+		{
+			uint32_t i = size();
+			name.push_back(n); depth.push_back(i ? depth[p] + 1 : 0);
+			parent.push_back(p); child.push_back(0); last.push_back(0); next.push_back(0);
+			time.push_back(clock::duration::zero()); min.push_back(clock::duration::max()); max.push_back(clock::duration::zero());
+			start.emplace_back(); count.push_back(0); mean.push_back(0.0); m2.push_back(0.0); histogram.push_back(nullptr);
+			usage.emplace_back();
+
+			if(i) { (last[p] ? next[last[p]] : child[p]) = i; last[p] = i; }
+			maxNameLength = std::max(names[n].size(), maxNameLength);
+			maxDepth = std::max<size_t>(depth[i], maxDepth);
+			return i;
+		}
+
+		Sample sample(uint32_t i) const { return {start[i], time[i], min[i], max[i], count[i], mean[i], m2[i], histogram[i], usage[i]}; }
+
+		// Adds measurements to the timer i
+		void add(uint32_t i, const Sample& from)
+		{
+			if(from.count == 0) return;
+
+			// Chan's formula for merging Welford's statistics
+			double n = count[i] + from.count, delta = from.mean - mean[i];
+			m2[i] += from.m2 + delta * delta * count[i] * from.count / n;
+			mean[i] += delta * from.count / n;
+
+			if((count[i] + from.count > 1 || from.histogram) && not histogram[i])
+			{
+				histogram[i] = arena.make<Histogram>();
+				if(count[i]) histogram[i]->add(min[i]);
+			}
+			if(from.histogram) histogram[i]->add(*from.histogram);
+			else if(histogram[i]) histogram[i]->add(from.min);
+
+			start[i] = count[i] ? std::min(start[i], from.start) : from.start;
+			time[i] += from.time;
+			min[i] = std::min(min[i], from.min);
+			max[i] = std::max(max[i], from.max);
+			count[i] += from.count;
+			for(size_t u = 0; u < usages; u++) __accumulate(usage[i][u], from.usage[u], u);
+		}
+
+		clock::duration total(uint32_t i) const
+		{
+			clock::duration sum = clock::duration::zero();
+			for(uint32_t c = child[i]; c; c = next[c]) sum += time[c];
+			return sum;
+		}
+
+		// Time not spent in nested timers
+		clock::duration self(uint32_t i) const { return time[i] - std::min(time[i], total(i)); }
+
+		double deviation(uint32_t i) const { return count[i] > 1 ? std::sqrt(m2[i] / (count[i] - 1)) : 0.0; }
+
+		clock::duration percentile(uint32_t i, double p) const
+		{
+			if(not histogram[i]) return max[i];
+			return std::clamp(histogram[i]->percentile(p, count[i]), min[i], max[i]);
+		}
+	};
+
+	// Measurements of a tree at the last snapshot with reset
+	struct Baseline
+	{
+		Arena arena; // Histograms
+		std::unordered_map<const Timer*, Sample> samples;
+	};
+
+	// Turns the sample into calls since the baseline sample, and moves the baseline to the sample.
+	// Minimum and maximum since the baseline are estimated from the histogram
+	void __since(Sample& sample, Sample& baseline, Arena& arena)
+	{
+		Sample now = sample;
+		if(sample.histogram)
+		{
+			if(not baseline.histogram)
+			{
+				Histogram* previous = arena.make<Histogram>();
+				if(baseline.count) previous->add(baseline.time, baseline.count);
+				baseline.histogram = previous;
+			}
+			sample.min = clock::duration::max();
+			sample.max = clock::duration::zero();
+			for(size_t i = 0; i < Histogram::size; i++)
+			{
+				uint64_t count = sample.histogram->counts[i];
+				sample.histogram->counts[i] = count - baseline.histogram->counts[i];
+				baseline.histogram->counts[i] = count;
+				if(sample.histogram->counts[i] == 0) continue;
+				sample.min = std::min(sample.min, clock::duration(Histogram::value(i)));
+				sample.max = std::max(sample.max, clock::duration(Histogram::value(i)));
+			}
+			sample.min = std::clamp(sample.min, now.min, now.max);
+			sample.max = std::clamp(sample.max, now.min, now.max);
+		}
+
+		// Reverse of Chan's formula
+		sample.count = now.count - baseline.count;
+		sample.time = now.time - baseline.time;
+		for(size_t u = 0; u < usages; u++) if(not __maximum(u)) sample.usage[u] = now.usage[u] - baseline.usage[u];
+		if(sample.count && baseline.count)
+		{
+			double mean = (now.mean * now.count - baseline.mean * baseline.count) / sample.count, delta = mean - baseline.mean;
+			sample.m2 = std::max(0.0, now.m2 - baseline.m2 - delta * delta * baseline.count * sample.count / now.count);
+			sample.mean = mean;
+		}
+
+		Histogram* histogram = baseline.histogram;
+		baseline = now;
+		baseline.histogram = histogram;
+	}
+
+	// Merges children of `from` into children of the timer `into` by name, the k-th child
+	// with some name is merged with the k-th one. Not matched children are copied.
+	// With a baseline only calls since the baseline are added
+	void merge(Flat& flat, uint32_t into, const Timer* from, Baseline* baseline = nullptr)
+	{
+		Histogram histogram;
+		std::vector<std::pair<uint32_t, const Timer*>> stack = {{into, from}};
+		// Not yet matched children of a parent by name, the first one last
+		std::unordered_map<uint64_t, std::vector<uint32_t>> existing;
+		std::vector<uint32_t> children;
+		while(not stack.empty())
+		{
+			auto [parent, timer] = stack.back();
+			stack.pop_back();
+
+			children.clear();
+			for(uint32_t c = flat.child[parent]; c; c = flat.next[c]) children.push_back(c);
+			for(auto c = children.rbegin(); c != children.rend(); c++) existing[uint64_t(parent) << 32 | flat.name[*c]].push_back(*c);
+			for(Timer* child = timer->firstChild(); child; child = child->nextSibling())
+			{
+				uint32_t name = flat.id(child->name), target = 0;
+				if(not children.empty())
+				{
+					auto found = existing.find(uint64_t(parent) << 32 | name);
+					if(found != existing.end() && not found->second.empty()) { target = found->second.back(); found->second.pop_back(); }
+				}
+				if(not target) target = flat.node(parent, name);
+
+				Sample sample = __sample(child, histogram);
+				if(baseline) __since(sample, baseline->samples[child], baseline->arena);
+				flat.add(target, sample);
+				stack.push_back({target, child});
+			}
+		}
+	}
+
+	// Subtracts overhead of every timer and timers nested in it. Children come
+	// after their parent, so going backwards visits children first
+	void subtract(Flat& flat)
+	{
+		std::vector<uint64_t> calls(flat.size(), 0);
+		for(uint32_t i = flat.size() - 1; i > 0; i--)
+		{
+			auto cost = overhead * static_cast<clock::rep>(calls[i]) + selfOverhead * static_cast<clock::rep>(flat.count[i]);
+			flat.time[i] -= std::min(flat.time[i], cost);
+			calls[flat.parent[i]] += calls[i] + flat.count[i];
+		}
+	}
+
+	void sort(Flat& flat)
+	{
+		std::vector<uint32_t> children;
+		for(uint32_t i = 0; i < flat.size(); i++)
+		{
+			if(not flat.child[i]) continue;
+
+			children.clear();
+			for(uint32_t c = flat.child[i]; c; c = flat.next[c]) children.push_back(c);
+			std::sort(children.begin(), children.end(), [&](uint32_t a, uint32_t b) { return flat.time[a] > flat.time[b]; });
+
+			flat.child[i] = children.front();
+			flat.last[i] = children.back();
+			for(size_t k = 0; k < children.size(); k++) flat.next[children[k]] = k + 1 < children.size() ? children[k + 1] : 0;
+		}
+	}
+
+	template<typename T>
+	void __number(std::string& out, T value)
+	{
+		if constexpr (std::is_floating_point_v<T>) { char buffer[32]; out.append(buffer, std::snprintf(buffer, sizeof(buffer), "%g", double(value))); }
+		else out += std::to_string(value);
+	}
+
+	template<typename time_t, typename Duration>
+	void __time(std::string& out, Duration duration, size_t width = 0)
+	{
+		size_t begin = out.size();
+		__number(out, std::chrono::duration_cast<time_t>(duration).count());
+		if(out.size() - begin < width) out.insert(begin, width - (out.size() - begin), ' ');
+	}
+	
+	// Appends depth and name of the timer i
+	template<typename... Options>
+	void __name(std::string& out, const Flat& flat, uint32_t i)
+	{
+		size_t begin = out.size();
+
+		// Timer depth
+		if isOption(Color, Options) out += DIM;
+		for(size_t d = 1; d < flat.depth[i]; d++) out += "| ";
+		out += RESET;
+	
+		// Timer name
+		size_t depthLength = 3; if isOption(Color, Options) depthLength++;
+		out += flat.names[flat.name[i]];
+		out += ": ";
+		size_t width = flat.maxNameLength + depthLength*flat.maxDepth;
+		if isOption(Align, Options) if(out.size() - begin < width) out.append(width - (out.size() - begin), ' ');
+	}
+
+	// Appends one measurement to the output
+	template<typename time_t, typename... Options>
+	void __line(std::string& out, const Flat& flat, uint32_t i)
+	{
+		__name<Options...>(out, flat, i);
+		
+		// Time measured in time_t
+		size_t timeWidth = 0; if isOption(Align, Options) timeWidth = maxTimeLength;
+		if isOption(Color, Options) out += CYAN;
+		__time<time_t>(out, flat.time[i], timeWidth);
+		out += RESET + units<time_t>();
+
+		if isOption(Self, Options) { out += "\t\tself "; __time<time_t>(out, flat.self(i), timeWidth); out += units<time_t>(); }
+	
+		// Percentage
+		double percentage = 100.0 * flat.time[i] / flat.time[flat.parent[i]];
+		if isOption(Color, Options) out += percentageColor(percentage);
+		if isOption(Percentage, Options) { out += "\t\t"; __number(out, percentage); out += "%"; }
+		out += RESET;
+
+		// Call count with shortest and longest call
+		if isOption(Calls, Options)
+		{
+			out += "\t\tx"; __number(out, flat.count[i]); out += " [";
+			__time<time_t>(out, flat.count[i] ? flat.min[i] : clock::duration::zero()); out += units<time_t>() + ", ";
+			__time<time_t>(out, flat.max[i]); out += units<time_t>() + "]";
+		}
+
+		// Statistics of calls
+		using ticks = std::chrono::duration<double, clock::period>;
+		if isOption(Mean, Options)
+		{
+			out += "\t\tmean "; __time<time_t>(out, ticks(flat.mean[i])); out += units<time_t>();
+			out += " sd "; __time<time_t>(out, ticks(flat.deviation(i))); out += units<time_t>();
+		}
+		if isOption(Percentiles, Options)
+		{
+			out += "\t\t";
+			for(auto [label, p]: {std::pair{"p50 ", 50.0}, {" p90 ", 90.0}, {" p99 ", 99.0}, {" p999 ", 99.9}})
+				{ out += label; __time<time_t>(out, flat.percentile(i, p)); out += units<time_t>(); }
+		}
+		if isOption(Usage, Options) if constexpr (resources > 0)
+		{
+			// Columns are padded to the width of the time with Align
+			auto column = [&](uint64_t value) { size_t at = out.size(); __number(out, value); if(out.size() - at < timeWidth) out.insert(at, timeWidth - (out.size() - at), ' '); };
+			out += "\t\tcpu "; __time<time_t>(out, std::chrono::nanoseconds(flat.usage[i][cpuTime]), timeWidth); out += units<time_t>();
+			out += "\t\tswitches "; column(flat.usage[i][voluntarySwitches]); out += " / "; column(flat.usage[i][involuntarySwitches]);
+			out += "\t\tfaults "; column(flat.usage[i][minorFaults]); out += " / "; column(flat.usage[i][majorFaults]);
+		}
+		if isOption(Counters, Options) if constexpr (counters > 0)
+		{
+			const uint64_t* counter = flat.usage[i].data() + resources;
+			auto ratio = [&](double value) { if(counter[instructions]) __number(out, value); else out += "-"; };
+			out += "\t\tcycles "; __number(out, counter[cycles]);
+			out += "\t\tIPC "; ratio(counter[cycles] ? double(counter[instructions]) / counter[cycles] : 0.0);
+			out += "\t\tMPKI cache "; ratio(1000.0 * counter[cacheMisses] / std::max<uint64_t>(counter[instructions], 1));
+			out += " branch "; ratio(1000.0 * counter[branchMisses] / std::max<uint64_t>(counter[instructions], 1));
+			out += " LLC "; ratio(1000.0 * counter[llcMisses] / std::max<uint64_t>(counter[instructions], 1));
+		}
+		if isOption(Allocations, Options) if constexpr (allocations > 0)
+		{
+			const uint64_t* heap = flat.usage[i].data() + resources + counters;
+			out += "\t\theap "; __number(out, heap[heapBytes]); out += "B x"; __number(out, heap[heapAllocations]);
+			out += " peak "; __number(out, heap[heapPeak]); out += "B";
+		}
+
+		out += '\n';
+	}
+
+	// Converts measurements to string, in one buffer and without recursion
+	template<typename time_t, typename... Options>
+	std::string __string(const Flat& flat)
+	{
+		size_t lineLength = flat.maxNameLength + 4*flat.maxDepth + maxTimeLength + 16;
+		if isOption(Calls, Options) lineLength += 32;
+		if isOption(Mean, Options) lineLength += 32;
+		if isOption(Percentiles, Options) lineLength += 64;
+
+		std::string out;
+		out.reserve(lineLength * flat.size());
+
+		// Pre-order: the first child is visited before the next sibling
+		std::vector<uint32_t> stack;
+		if(flat.child[0]) stack.push_back(flat.child[0]);
+		while(not stack.empty())
+		{
+			uint32_t i = stack.back();
+			stack.pop_back();
+			__line<time_t, Options...>(out, flat, i);
+
+			if(flat.next[i]) stack.push_back(flat.next[i]);
+			if(flat.child[i]) stack.push_back(flat.child[i]);
+		}
+		return out;
+	}
+
+	// Table of the n names with the most self time summed over all call paths, with their share of
+	// all time and call count. Self times are computed in one backward pass (children come after
+	// their parent) and only the top n are sorted
+	template<typename time_t = std::chrono::milliseconds, typename... Options>
+	std::string hotspots(const Flat& flat, size_t n = 10)
+	{
+		std::vector<clock::duration> children(flat.size(), clock::duration::zero()), self(flat.names.size(), clock::duration::zero());
+		std::vector<uint64_t> calls(flat.names.size(), 0);
+		clock::duration all = clock::duration::zero();
+		for(uint32_t i = flat.size() - 1; i > 0; i--)
+		{
+			clock::duration own = flat.time[i] - std::min(flat.time[i], children[i]);
+			children[flat.parent[i]] += flat.time[i];
+			self[flat.name[i]] += own;
+			calls[flat.name[i]] += flat.count[i];
+			all += own;
+		}
+
+		std::vector<uint32_t> names;
+		for(uint32_t name = 0; name < self.size(); name++) if(self[name] > clock::duration::zero()) names.push_back(name);
+		n = std::min(n, names.size());
+		std::partial_sort(names.begin(), names.begin() + n, names.end(), [&](uint32_t a, uint32_t b) { return self[a] > self[b]; });
+
+		size_t nameWidth = 0, timeWidth = 0;
+		if isOption(Align, Options) { for(size_t k = 0; k < n; k++) nameWidth = std::max(nameWidth, flat.names[names[k]].size()); timeWidth = maxTimeLength; }
+
+		std::string out = "Hotspots (self time):\n";
+		for(size_t k = 0; k < n; k++)
+		{
+			uint32_t name = names[k];
+			double percentage = all.count() ? 100.0 * self[name].count() / all.count() : 0.0;
+			out += std::to_string(k + 1) + ". ";
+			out += flat.names[name];
+			out += ": ";
+			if(flat.names[name].size() < nameWidth) out.append(nameWidth - flat.names[name].size(), ' ');
+			if isOption(Color, Options) out += CYAN;
+			__time<time_t>(out, self[name], timeWidth);
+			out += RESET + units<time_t>();
+			if isOption(Color, Options) out += percentageColor(percentage);
+			out += "\t\t"; __number(out, percentage); out += "%" + RESET;
+			out += "\t\tx"; __number(out, calls[name]); out += "\n";
+		}
+		return out;
+	}
+
+	std::vector<Baseline> baselines; // Of every tree, guarded by treesMutex
+
+	// Copies finished calls of all threads to a flat tree, the threads are not stopped
+	// or locked while recording. With reset only calls since the last reset are copied
+	// (keep AGGREGATE on, so that memory of long running programs stays bounded)
+	template<typename... Options>
+	Flat snapshot(bool reset = false)
+	{
+		std::lock_guard<std::mutex> lock(treesMutex);
+		baselines.resize(trees.size());
+
+		Flat flat;
+		for(size_t i = 0; i < trees.size(); i++)
+		{
+			if(not trees[i]->firstChild()) continue;
+
+			uint32_t into = 0;
+			if isOption(Threads, Options)
+			{
+				into = flat.node(0, flat.id("Thread " + std::to_string(i)));
+
+				Sample thread;
+				thread.time = thread.min = thread.max = total(trees[i]);
+				thread.mean = thread.time.count();
+				thread.count = 1;
+				flat.add(into, thread);
+			}
+			merge(flat, into, trees[i], reset ? &baselines[i] : nullptr);
+		}
+		return flat;
+	}
+
+	// Converts a snapshot to string, options that change the timers work on a copy
+	template<typename... Options>
+	std::string string(Flat&& flat)
+	{
+		using time_t = get_time_t<std::chrono::milliseconds, Options...>;
+
+		if isOption(Overhead, Options) if(not calibrated) calibrate();
+		if isOption(Overhead, Options) subtract(flat);
+		
+		if isOption(Sort, Options) sort(flat);
+
+		if isOption(Percentage, Options) flat.time[0] = flat.total(0);
+		
+		if isOption(Hotspots, Options) return __string<time_t, Options...>(flat) + "\n" + hotspots<time_t, Options...>(flat);
+		return __string<time_t, Options...>(flat);
+	}
+
+	template<typename... Options>
+	std::string string(const Flat& flat)
+	{
+		if constexpr ((std::is_same_v<Options, Overhead> || ...) || (std::is_same_v<Options, Sort> || ...) || (std::is_same_v<Options, Percentage> || ...))
+			return string<Options...>(Flat(flat));
+
+		using time_t = get_time_t<std::chrono::milliseconds, Options...>;
+		if isOption(Hotspots, Options) return __string<time_t, Options...>(flat) + "\n" + hotspots<time_t, Options...>(flat);
+		return __string<time_t, Options...>(flat);
+	}
+
+	// Measurements stay sorted for later printing once printed with Sort
+	std::atomic<bool> sorted = false;
+
+	// Main function that converts measurements to string.
+	// Timers of other threads have to be stopped (e.g. threads joined) before printing
+	template<typename... Options>
+	std::string string()
+	{
+		if(not starts.empty()) return RED + "Error: Not all timers have stopped"; 
+		if isOption(Sort, Options) sorted = true;
+		if(sorted) return string<Sort, Options...>(snapshot<Options...>());
+		return string<Options...>(snapshot<Options...>());
+	}
+
+	// Saves the snapshot to a binary file, that can be loaded with the same clock period
+	bool save(const Flat& flat, const std::string& path)
+	{
+		std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(path.c_str(), "wb"), std::fclose);
+		if(not file) return false;
+		auto write = [&](const auto& value) { std::fwrite(&value, sizeof(value), 1, file.get()); };
+
+		std::fwrite("TIMERFLT", 1, 8, file.get());
+		write(int64_t(clock::period::num)); write(int64_t(clock::period::den)); write(uint32_t(usages));
+		write(uint32_t(flat.names.size()));
+		for(auto name: flat.names) { write(uint32_t(name.size())); std::fwrite(name.data(), 1, name.size(), file.get()); }
+
+		write(flat.size());
+		for(uint32_t i = 1; i < flat.size(); i++)
+		{
+			write(flat.parent[i]); write(flat.name[i]);
+			write(flat.time[i].count()); write(flat.min[i].count()); write(flat.max[i].count()); write(flat.start[i].time_since_epoch().count());
+			write(flat.count[i]); write(flat.mean[i]); write(flat.m2[i]);
+			for(auto value: flat.usage[i]) write(value);
+
+			// Histogram as nonzero buckets
+			uint32_t buckets = 0;
+			if(flat.histogram[i]) for(auto& count: flat.histogram[i]->counts) buckets += count != 0;
+			write(buckets);
+			if(flat.histogram[i]) for(uint32_t b = 0; b < Histogram::size; b++) if(flat.histogram[i]->counts[b]) { write(b); write(uint64_t(flat.histogram[i]->counts[b])); }
+		}
+		return std::ferror(file.get()) == 0;
+	}
+
+	// Loads a snapshot saved by save(), usages measured with other defines are dropped
+	bool load(const std::string& path, Flat& flat)
+	{
+		std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(path.c_str(), "rb"), std::fclose);
+		auto read = [&](auto& value) { return std::fread(&value, sizeof(value), 1, file.get()) == 1; };
+
+		char magic[8];
+		int64_t num, den;
+		uint32_t savedUsages, names, size;
+		if(not file || std::fread(magic, 1, 8, file.get()) != 8 || std::string_view(magic, 8) != "TIMERFLT") return false;
+		if(not read(num) || not read(den) || num != clock::period::num || den != clock::period::den || not read(savedUsages)) return false;
+
+		flat = Flat();
+		std::vector<uint32_t> ids;
+		if(not read(names)) return false;
+		for(uint32_t n = 0; n < names; n++)
+		{
+			uint32_t length;
+			if(not read(length) || length > __remaining(file.get())) return false;
+			std::string name(length, '\0');
+			if(std::fread(name.data(), 1, length, file.get()) != length) return false;
+			ids.push_back(flat.id(name));
+		}
+
+		if(not read(size)) return false;
+		for(uint32_t i = 1; i < size; i++)
+		{
+			uint32_t parent, name, buckets;
+			clock::rep time, min, max, start;
+			if(not read(parent) || not read(name) || parent >= i || name >= ids.size()) return false;
+			flat.node(parent, ids[name]);
+			if(not read(time) || not read(min) || not read(max) || not read(start)) return false;
+			flat.time[i] = clock::duration(time); flat.min[i] = clock::duration(min); flat.max[i] = clock::duration(max);
+			flat.start[i] = clock::time_point(clock::duration(start));
+			if(not read(flat.count[i]) || not read(flat.mean[i]) || not read(flat.m2[i])) return false;
+			for(uint32_t u = 0; u < savedUsages; u++) { uint64_t value; if(not read(value)) return false; if(u < usages) flat.usage[i][u] = value; }
+
+			if(not read(buckets)) return false;
+			if(buckets) flat.histogram[i] = flat.arena.make<Histogram>();
+			for(uint32_t b = 0; b < buckets; b++)
+			{
+				uint32_t bucket;
+				uint64_t count;
+				if(not read(bucket) || not read(count) || bucket >= Histogram::size) return false;
+				flat.histogram[i]->counts[bucket] = count;
+			}
+		}
+		return true;
+	}
+
+	// Compares two snapshots (e.g. saved before and after a change), timers are matched by call path.
+	// Every timer shows both times and the change, colored by deltaColor() with Color
+	template<typename... Options>
+	std::string diff(const Flat& baseline, const Flat& candidate)
+	{
+		using time_t = get_time_t<std::chrono::milliseconds, Options...>;
+
+		// Union of both trees, timers of the candidate first
+		Flat both;
+		std::vector<clock::duration> before(1, clock::duration::zero());
+		std::unordered_map<uint64_t, uint32_t> paths; // By parent and name
+		auto add = [&](const Flat& flat, bool isCandidate)
+		{
+			std::vector<uint32_t> into(flat.size(), 0);
+			for(uint32_t i = 1; i < flat.size(); i++)
+			{
+				uint32_t parent = into[flat.parent[i]], name = both.id(flat.names[flat.name[i]]);
+				auto [found, inserted] = paths.try_emplace(uint64_t(parent) << 32 | name, both.size());
+				if(inserted) { both.node(parent, name); before.push_back(clock::duration::zero()); }
+				into[i] = found->second;
+				(isCandidate ? both.time : before)[into[i]] += flat.time[i];
+			}
+		};
+		add(candidate, true);
+		add(baseline, false);
+		
+		if isOption(Sort, Options) sort(both);
+
+		size_t timeWidth = 0; if isOption(Align, Options) timeWidth = maxTimeLength;
+		std::string out;
+		std::vector<uint32_t> stack;
+		if(both.child[0]) stack.push_back(both.child[0]);
+		while(not stack.empty())
+		{
+			uint32_t i = stack.back();
+			stack.pop_back();
+
+			__name<Options...>(out, both, i);
+			__time<time_t>(out, before[i], timeWidth); out += units<time_t>() + " -> ";
+			if isOption(Color, Options) out += CYAN;
+			__time<time_t>(out, both.time[i], timeWidth); out += RESET + units<time_t>();
+
+			auto delta = both.time[i] - before[i];
+			double percentage = before[i].count() ? 100.0 * delta.count() / before[i].count() : delta.count() ? 100.0 : 0.0;
+			if isOption(Color, Options) out += deltaColor(percentage);
+			out += "\t\t";
+			if(delta.count() >= 0) out += "+";
+			__time<time_t>(out, delta); out += units<time_t>() + " (";
+			if(before[i].count() == 0) out += "new";
+			else if(both.time[i].count() == 0) out += "removed";
+			else { if(percentage >= 0) out += "+"; __number(out, percentage); out += "%"; }
+			out += ")" + RESET + "\n";
+
+			if(both.next[i]) stack.push_back(both.next[i]);
+			if(both.child[i]) stack.push_back(both.child[i]);
+		}
+		return out;
+	}
+
+	// Converts a snapshot to folded stacks (one "Outer;Inner self_time" line per timer) for
+	// flamegraph.pl or speedscope, with self times in time_t units
+	template<typename time_t = std::chrono::microseconds>
+	std::string folded(const Flat& flat)
+	{
+		std::string out;
+		std::vector<std::string> paths(flat.size());
+		for(uint32_t i = 1; i < flat.size(); i++)
+		{
+			std::string name(flat.names[flat.name[i]]);
+			std::replace(name.begin(), name.end(), ';', ':');
+			std::replace(name.begin(), name.end(), '\n', ' ');
+			paths[i] = flat.parent[i] ? paths[flat.parent[i]] + ";" + name : name;
+
+			auto self = std::chrono::duration_cast<time_t>(flat.self(i)).count();
+			if(self > 0) out += paths[i] + " " + std::to_string(self) + "\n";
+		}
+		return out;
+	}
+
+	// Microseconds with three decimals, exact also for timestamps since epoch
+	std::string __microseconds(clock::duration duration)
+	{
+		auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+		std::string decimals = std::to_string(1000 + nanoseconds % 1000);
+		return std::to_string(nanoseconds / 1000) + "." + decimals.substr(1);
+	}
+
+#ifndef AGGREGATE
+	// Converts measurements of all threads to Chrome Trace Event format (JSON), that can be
+	// opened in chrome://tracing or Perfetto. Only timers of single calls are intervals of the
+	// timeline, so it is not available with AGGREGATE (also not for traces loaded by load())
+	// and timers of several calls (Benchmark, sampled scopes) are skipped
+	std::string chromeTrace()
+	{
+		std::stringstream stream;
+		stream << "{\"traceEvents\":[";
+
+		std::lock_guard<std::mutex> lock(treesMutex);
+		Histogram histogram;
+		bool first = true;
+		for(size_t i = 0; i < trees.size(); i++)
+			for(auto& timer: *trees[i])
+			{
+				if(not timer.parent) continue;
+				Sample sample = __sample(&timer, histogram);
+				if(sample.count != 1) continue; // Running timers and timers of several calls
+				stream << (first ? "\n" : ",\n") << "{\"name\":\"" << __json(timer.name) << "\",\"cat\":\"timer\",\"ph\":\"X\"";
+				stream << ",\"ts\":" << __microseconds(sample.start.time_since_epoch());
+				stream << ",\"dur\":" << __microseconds(sample.time);
+				stream << ",\"pid\":0,\"tid\":" << i << "}";
+				first = false;
+			}
+
+		stream << "\n],\"displayTimeUnit\":\"ns\"}\n";
+		return stream.str();
+	}
+#endif
+
+	std::string __label(std::string_view s)
+	{
+		std::string result;
+		for(char c: s)
+		{
+			if(c == '"' || c == '\\') result += '\\';
+			if(c == '\n') result += "\\n";
+			else result += c;
+		}
+		return result;
+	}
+
+	std::string __seconds(clock::duration duration)
+	{
+		char number[32];
+		std::snprintf(number, sizeof(number), "%.9g", std::chrono::duration<double>(duration).count());
+		return number;
+	}
+
+	// Converts a snapshot to OpenMetrics text format, every timer is a summary labelled
+	// by its call path (e.g. path="Outer/Inner"), timers with the same path are merged
+	std::string openMetrics(Flat&& flat)
+	{
+		std::string out = "# TYPE timer_seconds summary\n# UNIT timer_seconds seconds\n# HELP timer_seconds Finished calls by call path\n";
+
+		std::vector<std::string> paths(flat.size());
+		std::unordered_map<std::string, uint32_t> first;
+		std::vector<uint32_t> timers;
+		for(uint32_t i = 1; i < flat.size(); i++)
+		{
+			uint32_t parent = flat.parent[i];
+			paths[i] = (parent ? paths[parent] + "/" : "") + __label(flat.names[flat.name[i]]);
+
+			auto [found, inserted] = first.emplace(paths[i], i);
+			if(inserted) { timers.push_back(i); continue; }
+
+			uint32_t into = found->second;
+			flat.add(into, flat.sample(i));
+		}
+
+		for(uint32_t i: timers)
+		{
+			if(flat.count[i] == 0) continue;
+			std::string path = "{path=\"" + paths[i] + "\"";
+			for(auto [label, p]: {std::pair{"0.5", 50.0}, {"0.9", 90.0}, {"0.99", 99.0}, {"0.999", 99.9}})
+				out += "timer_seconds" + path + ",quantile=\"" + label + "\"} " + __seconds(flat.percentile(i, p)) + "\n";
+			out += "timer_seconds_sum" + path + "} " + __seconds(flat.time[i]) + "\n";
+			out += "timer_seconds_count" + path + "} " + std::to_string(flat.count[i]) + "\n";
+		}
+		return out + "# EOF\n";
+	}
+
+	std::string openMetrics(const Flat& flat) { return openMetrics(Flat(flat)); }
+
+	// Runs a task periodically in a background thread
+	class __Reporter
+	{
+		std::thread thread;
+		std::mutex mutex;
+		std::condition_variable wake;
+		bool stopped = false;
+
+	public:
+		void start(std::chrono::milliseconds interval, std::function<void()> task)
+		{
+			stop();
+			stopped = false;
+			thread = std::thread([this, interval, task]{
+				std::unique_lock<std::mutex> lock(mutex);
+				while(not wake.wait_for(lock, interval, [this]{ return stopped; })) task();
+			});
+		}
+
+		void stop()
+		{
+			if(not thread.joinable()) return;
+			{ std::lock_guard<std::mutex> lock(mutex); stopped = true; }
+			wake.notify_one();
+			thread.join();
+		}
+
+		~__Reporter() { stop(); }
+	} reporter;
+
+	// Writes the metrics of all threads to the file every interval (replaced atomically, e.g. for
+	// the node exporter textfile collector). Snapshots never block threads that are measuring
+	bool report(const std::string& path, std::chrono::milliseconds interval = std::chrono::seconds(15))
+	{
+		reporter.stop();
+		std::string temporary = path + ".tmp";
+		auto write = [path, temporary]{
+			std::string metrics = openMetrics(snapshot());
+			std::FILE* file = std::fopen(temporary.c_str(), "wb");
+			if(not file) return false;
+			bool written = std::fwrite(metrics.data(), 1, metrics.size(), file) == metrics.size();
+			return std::fclose(file) == 0 && written && std::rename(temporary.c_str(), path.c_str()) == 0;
+		};
+		if(not write()) return false;
+		reporter.start(interval, [write]{ write(); });
+		return true;
+	}
+
+#ifdef SERVER
+	__Reporter server;
+	int serverSocket = -1;
+
+	// Serves the metrics of all threads on http://127.0.0.1:port/ (any path), a snapshot per request
+	bool serve(uint16_t port, std::chrono::milliseconds interval = std::chrono::milliseconds(50))
+	{
+		server.stop();
+		if(serverSocket >= 0) close(serverSocket);
+
+		serverSocket = socket(AF_INET, SOCK_STREAM, 0);
+		if(serverSocket < 0) return false;
+		int on = 1;
+		setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if(bind(serverSocket, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(serverSocket, 16) < 0
+			|| fcntl(serverSocket, F_SETFL, O_NONBLOCK) < 0)
+		{
+			close(serverSocket);
+			serverSocket = -1;
+			return false;
+		}
+
+		// Answers pending requests, checked every interval
+		server.start(interval, []{
+			for(int client; (client = accept(serverSocket, nullptr, nullptr)) >= 0; close(client))
+			{
+				timeval timeout = {1, 0};
+				setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+				setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+				char request[4096];
+				if(recv(client, request, sizeof(request), 0) <= 0) continue;
+
+				std::string metrics = openMetrics(snapshot());
+				std::string response = "HTTP/1.1 200 OK\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+					"Content-Length: " + std::to_string(metrics.size()) + "\r\nConnection: close\r\n\r\n" + metrics;
+				for(size_t sent = 0; sent < response.size();)
+				{
+					ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+					if(n <= 0) break;
+					sent += n;
+				}
+			}
+		});
+		return true;
+	}
+#endif
+
+	// Frees measurements of the current thread, its timers have to be stopped
+	void reset()
+	{
+		if(not starts.empty()) return;
+
+		std::lock_guard<std::mutex> lock(treesMutex);
+		size_t index = std::find(trees.begin(), trees.end(), tree) - trees.begin();
+		if(index < baselines.size()) baselines[index] = Baseline();
+		tree->child.store(nullptr, std::memory_order_release);
+		tree->last = nullptr;
+		arena->reset();
+		generation++;
+	}
+	
+}
+
+#ifdef ALLOCATIONS
+// Replaced global allocation functions counting heap usage of the thread (see ALLOCATIONS),
+// array, nothrow and sized forms call these
+inline void* __allocated(void* pointer)
+{
+	if(not pointer) throw std::bad_alloc();
+	if(Timer::__heapIgnored) return pointer;
+	int64_t size = malloc_usable_size(pointer);
+	Timer::__heapBytes += size;
+	Timer::__heapAllocations++;
+	Timer::__heapPeak = std::max(Timer::__heapPeak, Timer::__heapLive += size);
+	return pointer;
+}
+
+__attribute__((noinline)) inline void __freed(void* pointer)
+{
+	if(pointer && not Timer::__heapIgnored) Timer::__heapLive -= malloc_usable_size(pointer);
+	std::free(pointer);
+}
+
+void* operator new(size_t size) { return __allocated(std::malloc(size ? size : 1)); }
+void* operator new(size_t size, std::align_val_t align)
+{
+	size_t alignment = std::max(size_t(align), sizeof(void*));
+	return __allocated(std::aligned_alloc(alignment, (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment));
+}
+void operator delete(void* pointer) noexcept { __freed(pointer); }
+void operator delete(void* pointer, size_t) noexcept { __freed(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { __freed(pointer); }
+void operator delete(void* pointer, size_t, std::align_val_t) noexcept { __freed(pointer); }
+#endif